@@ -0,0 +1,16 @@
+# Runs chip8_verify built with one dispatch engine and with the switch engine (the reference path of Chip8::Cycle()).
+# Fails unless both pass their own checks and end on the same cycle count and display hash.
+#     cmake -DENGINE=<chip8_verify_x> -DREFERENCE=<chip8_verify_switch> -DROM=<rom> -P VerifyDispatch.cmake
+
+foreach(build ENGINE REFERENCE)
+    execute_process(COMMAND ${${build}} ${ROM} RESULT_VARIABLE result OUTPUT_VARIABLE output)
+    message("${output}")
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${${build}} failed on ${ROM}")
+    endif()
+    string(REGEX MATCH "end cycles [0-9]+ hash [0-9a-f]+" ${build}_END "${output}")
+endforeach()
+
+if(NOT ENGINE_END STREQUAL REFERENCE_END)
+    message(FATAL_ERROR "${ENGINE} ends with '${ENGINE_END}', the switch engine with '${REFERENCE_END}'")
+endif()
@@ -2,7 +2,20 @@
 // Created by Dhruv Rawat on 2020-07-08.
 //
 
-#include "Classes.h"
+#include "Chip8.h"
+#include "Log.h"
+#include "Threaded.h"
+#include "Trace.h"
+#include "Video.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_CONSTEXPR
+#include "OpTable.h"
+#endif
+#if CHIP8_JIT
+#include "Jit.h"
+#endif
 
 /*Fonts and text*/
 //16 characters at 5 bytes each (5*16 = 80 array elements)
@@ -27,262 +40,786 @@ unsigned char chip8_fontset[FONTSET_SIZE] = { //defines all fonts. Each characte
     0xF0, 0x80, 0xF0, 0x80, 0x80  //F
 };
 
-/* Start addresses */
-const unsigned int START_ADD = 0x200; //start address for the program counter
-const unsigned int FONTSET_START_ADD = 0x50; 
-
-Chip8::Chip8():randGen(std::chrono::system_clock::now().time_since_epoch().count()) //seed random number generator into the constructor with system clock
+Chip8::Chip8():MachineState() //zeroes the whole machine state
 {
 	pc = START_ADD; //initialize the program counter
+	instructionsPerSecond = 600;
+	random = RandomSeed(std::chrono::system_clock::now().time_since_epoch().count()); //seed random number generator with system clock
 
-    for(int i = 0; i < FONTSET_SIZE; i++) { //loads fontset into memory
+    for(unsigned int i = 0; i < FONTSET_SIZE; i++) { //loads fontset into memory
         memory[FONTSET_START_ADD + i] = chip8_fontset[i];
     }
-    
-    randByte = std::uniform_int_distribution<uint8_t>(0, 255U); //initialize random number generator. With this we can get number between 0 and 255
 
-	std::cerr << "Chip8 constructed\n";
+	LOG_INFO("Chip8 constructed");
+}
+
+void* Chip8::operator new(size_t size) {
+	void* chip;
+	if (posix_memalign(&chip, alignof(Chip8), size)) {
+		throw std::bad_alloc();
+	}
+	return chip;
+}
+
+void Chip8::operator delete(void* chip) {
+	free(chip);
 }
 
-/* Loads contents from ROM file into memory so we can execute instructions */
-void Chip8::loadROM(char const* romfile) {
+/* Loads contents from ROM file into memory so we can execute instructions, false (memory untouched) if it can't */
+bool Chip8::loadROM(char const* romfile) {
 	FILE* file;
 
 	// open file
-	file = fopen(romfile, "r");
+	file = fopen(romfile, "rb");
 	if (!file) {
-		std::cerr << "File not loaded\n";
-		exit(2);
+		LOG_ERROR("File not loaded: " << romfile);
+		return false;
 	}
 
-	// check file size
-	fseek(file, 0L, SEEK_END);
-	uint32_t size = ftell(file);
-	rewind(file);
+	// read up to one byte more than fits, so a file that is too large shows up without trusting ftell()
+	uint8_t rom[MEMSIZE - START_ADD + 1];
+	size_t size = fread(rom, 1, sizeof(rom), file);
+	bool failed = ferror(file) != 0;
+	fclose(file);
 
+	if (failed) {
+		LOG_ERROR("File could not be read: " << romfile);
+		return false;
+	}
 	if (size > (MEMSIZE - START_ADD)) {
-		std::cerr << "File too large\n";
-		exit(2);
+		LOG_ERROR("File too large: " << romfile);
+		return false;
 	}
 
-	// read rom into memory
-	fread(&memory[START_ADD], 1, size, file);
+	// copy rom into memory
+	memcpy(&memory[START_ADD], rom, size);
+	CodeReset();
+	LOG_INFO("ROM loaded");
+	return true;
+}
 
-	fclose(file);
-	std::cerr << "ROM loaded\n";
+/* Dispatch engines (the engine used by Chip8::Cycle() is chosen with CHIP8_DISPATCH, see Chip8.h) */
+
+/* Splits an opcode into the operand fields used by the instruction methods */
+Instruction Chip8::Decode(uint16_t opcode) {
+	Instruction in;
+	in.opcode = opcode;
+	in.nnn = opcode & 0x0FFFu;
+	in.x = (opcode & 0x0F00u) >> 8u;
+	in.y = (opcode & 0x00F0u) >> 4u;
+	in.n = opcode & 0x000Fu;
+	in.kk = opcode & 0x00FFu;
+	return in;
 }
 
-void Chip8::Cycle() {
-	/*
-		Steps iterated in each cycle:
-			1. Fetch next cpu instruction from the opcode.
-			2. Decode the instruction to determine which operation needs to take place (done using the switch statement).
-			3. Execute the instruction (done in instruction methods below)
-	*/
+/*
+	Precomputed decode tables. Every opcode maps to a leaf instruction id through a single lookup on its first nibble and
+	low byte (the 0x8 family only looks at the low nibble, so all 16 values of y share an entry).
+*/
+struct Chip8::Tables {
+	uint8_t ids[16][256]; //[opcode >> 12][opcode & 0xFF] -> OpId
+	Handler handlers[ID_COUNT]; //OpId -> instruction method
+
+	Tables() {
+		for (int i = 0; i < 16; i++) {
+			for (int j = 0; j < 256; j++) {
+				ids[i][j] = ID_NULL;
+			}
+		}
 
-	// Fetchches instruction 
-	opcode = (memory[pc] << 8u) | memory[pc + 1]; //Get first digit of OP code with a bitmask and shift so it becmes a single digit from $0 to $F
+		const uint8_t single[16] = {
+			ID_NULL, ID_1nnn, ID_2nnn, ID_3xkk, ID_4xkk, ID_5xy0, ID_6xkk, ID_7xkk,
+			ID_NULL, ID_9xy0, ID_Annn, ID_Bnnn, ID_Cxkk, ID_Dxyn, ID_NULL, ID_NULL
+		};
+		for (int i = 0; i < 16; i++) {
+			if (single[i] != ID_NULL) {
+				for (int j = 0; j < 256; j++) {
+					ids[i][j] = single[i];
+				}
+			}
+		}
 
-	// For debugging purposes
-	// std::cerr << "Binary: " <<  0xF000 << " | Mem: " << (memory[pc] << 8u) << " | Mem2: " << memory[pc + 1] <<  " | OP Code: " << opcode << " | Both: " << ((opcode & 0xF000)) << "\n";
+		const uint8_t family8[16] = {
+			ID_8xy0, ID_8xy1, ID_8xy2, ID_8xy3, ID_8xy4, ID_8xy5, ID_8xy6, ID_8xy7,
+			ID_NULL, ID_NULL, ID_NULL, ID_NULL, ID_NULL, ID_NULL, ID_8xyE, ID_NULL
+		};
+		for (int j = 0; j < 256; j++) {
+			ids[0x8][j] = family8[j & 0xF];
+		}
 
-	// Increment the PC before executing anything (prevents a continuous loop from occuring)
-	pc += 2; 
-	
-	switch(opcode & 0xF000) {
+		ids[0x0][0xE0] = ID_00E0;
+		ids[0x0][0xEE] = ID_00EE;
+		ids[0xE][0x9E] = ID_Ex9E;
+		ids[0xE][0xA1] = ID_ExA1;
+		ids[0xF][0x07] = ID_Fx07;
+		ids[0xF][0x0A] = ID_Fx0A;
+		ids[0xF][0x15] = ID_Fx15;
+		ids[0xF][0x18] = ID_Fx18;
+		ids[0xF][0x1E] = ID_Fx1E;
+		ids[0xF][0x29] = ID_Fx29;
+		ids[0xF][0x33] = ID_Fx33;
+		ids[0xF][0x55] = ID_Fx55;
+		ids[0xF][0x65] = ID_Fx65;
+
+		handlers[ID_NULL] = &Chip8::OP_NULL;
+		handlers[ID_00E0] = &Chip8::OP_00E0;
+		handlers[ID_00EE] = &Chip8::OP_00EE;
+		handlers[ID_1nnn] = &Chip8::OP_1nnn;
+		handlers[ID_2nnn] = &Chip8::OP_2nnn;
+		handlers[ID_3xkk] = &Chip8::OP_3xkk;
+		handlers[ID_4xkk] = &Chip8::OP_4xkk;
+		handlers[ID_5xy0] = &Chip8::OP_5xy0;
+		handlers[ID_6xkk] = &Chip8::OP_6xkk;
+		handlers[ID_7xkk] = &Chip8::OP_7xkk;
+		handlers[ID_8xy0] = &Chip8::OP_8xy0;
+		handlers[ID_8xy1] = &Chip8::OP_8xy1;
+		handlers[ID_8xy2] = &Chip8::OP_8xy2;
+		handlers[ID_8xy3] = &Chip8::OP_8xy3;
+		handlers[ID_8xy4] = &Chip8::OP_8xy4;
+		handlers[ID_8xy5] = &Chip8::OP_8xy5;
+		handlers[ID_8xy6] = &Chip8::OP_8xy6;
+		handlers[ID_8xy7] = &Chip8::OP_8xy7;
+		handlers[ID_8xyE] = &Chip8::OP_8xyE;
+		handlers[ID_9xy0] = &Chip8::OP_9xy0;
+		handlers[ID_Annn] = &Chip8::OP_Annn;
+		handlers[ID_Bnnn] = &Chip8::OP_Bnnn;
+		handlers[ID_Cxkk] = &Chip8::OP_Cxkk;
+		handlers[ID_Dxyn] = &Chip8::OP_Dxyn;
+		handlers[ID_Ex9E] = &Chip8::OP_Ex9E;
+		handlers[ID_ExA1] = &Chip8::OP_ExA1;
+		handlers[ID_Fx07] = &Chip8::OP_Fx07;
+		handlers[ID_Fx0A] = &Chip8::OP_Fx0A;
+		handlers[ID_Fx15] = &Chip8::OP_Fx15;
+		handlers[ID_Fx18] = &Chip8::OP_Fx18;
+		handlers[ID_Fx1E] = &Chip8::OP_Fx1E;
+		handlers[ID_Fx29] = &Chip8::OP_Fx29;
+		handlers[ID_Fx33] = &Chip8::OP_Fx33;
+		handlers[ID_Fx55] = &Chip8::OP_Fx55;
+		handlers[ID_Fx65] = &Chip8::OP_Fx65;
+	}
+};
+
+const Chip8::Tables Chip8::tables;
+
+/* Reference engine: nested switch on the opcode families */
+void Chip8::DispatchSwitch(Instruction const& in) {
+	switch(in.opcode & 0xF000) {
 		case 0x0000: 
-			switch(opcode & 0x00FF) {
+			switch(in.opcode & 0x00FF) {
 				case 0x00E0: 
-					this->OP_00E0();
+					this->OP_00E0(in);
 					break;
 
 				case 0x00EE: 
-					this->OP_00EE();
+					this->OP_00EE(in);
 					break;
 
 				default:
-					std::cerr << "0x0000 --> invalid op code\n";
-					exit(0);
+					LOG_DEBUG("0x0000 --> invalid op code");
+					this->OP_NULL(in);
 			}
 			break;
 		
 		case 0x1000: 
-			this->OP_1nnn();
+			this->OP_1nnn(in);
 			break;
 		
 		case 0x2000: 
-			this->OP_2nnn();
+			this->OP_2nnn(in);
 			break;
 		
 		case 0x3000:
-			this->OP_3xkk();
+			this->OP_3xkk(in);
 			break;
 		
 		case 0x4000: 
-			this->OP_4xkk();
+			this->OP_4xkk(in);
 			break;
 		
 		case 0x5000: 
-			this->OP_5xy0();
+			this->OP_5xy0(in);
 			break;
 		
 		case 0x6000:
-			this->OP_6xkk();
+			this->OP_6xkk(in);
 			break;
 		
 		case 0x7000: 
-			this->OP_7xkk();
+			this->OP_7xkk(in);
 			break;
 		
 		case 0x8000: 
-			switch (opcode & 0x000F) {
+			switch (in.opcode & 0x000F) {
 				case 0x0000: 
-					this->OP_8xy0();
+					this->OP_8xy0(in);
 					break;
 				
 				case 0x0001: 
-					this->OP_8xy1();
+					this->OP_8xy1(in);
 					break;
 				
 				case 0x0002: 
-					this->OP_8xy2();
+					this->OP_8xy2(in);
 					break;
 				
 				case 0x0003: 
-					this->OP_8xy3();
+					this->OP_8xy3(in);
 					break;
 				
 				case 0x0004: 
-					this->OP_8xy4();
+					this->OP_8xy4(in);
 					break;
 				
 				case 0x0005: 
-					this->OP_8xy5();
+					this->OP_8xy5(in);
 					break;
 				
 				case 0x0006: 
-					this->OP_8xy6();
+					this->OP_8xy6(in);
 					break;
 				
 				case 0x0007: 
-					this->OP_8xy7();
+					this->OP_8xy7(in);
 					break;
 				
 				case 0x000E: 
-					this->OP_8xyE();
+					this->OP_8xyE(in);
 					break;
 				
 				default:
-					std::cerr << "0x8000 -> invalid opcode\n";
-					exit(0);
+					LOG_DEBUG("0x8000 -> invalid opcode");
+					this->OP_NULL(in);
 			}
 			break;
 		
 		case 0x9000: 
-			this->OP_9xy0();
+			this->OP_9xy0(in);
 			break;
 		
 		case 0xA000: 
-			this->OP_Annn();
+			this->OP_Annn(in);
 			break;
 		
 		case 0xB000:
-			this->OP_Bnnn();
+			this->OP_Bnnn(in);
 			break;
 		
 		case 0xC000:
-			this->OP_Cxkk(); 
+			this->OP_Cxkk(in); 
 			break;
 		
 		case 0xD000:
-			this->OP_Dxyn();
+			this->OP_Dxyn(in);
 			break;
 		
 		case 0xE000:
-			switch (opcode & 0x00FF) {
+			switch (in.opcode & 0x00FF) {
 				case 0x009E:
-					this->OP_Ex9E();
+					this->OP_Ex9E(in);
 					break;
 				
 				case 0x00A1:
-					this->OP_ExA1();
+					this->OP_ExA1(in);
 					break;
 
 				default:
-					std::cerr << "0xE000 -> invalid opcode\n";
-					exit(0);
+					LOG_DEBUG("0xE000 -> invalid opcode");
+					this->OP_NULL(in);
 			}
 			break;
 		
 		case 0xF000: 
-			switch (opcode & 0x00FF) {
+			switch (in.opcode & 0x00FF) {
 				case 0x0007:
-					this->OP_Fx07();
+					this->OP_Fx07(in);
 					break;
 				
 				case 0x000A:
-					this->OP_Fx0A();
+					this->OP_Fx0A(in);
 					break;
 					
 				case 0x0015:
-					this->OP_Fx15();
+					this->OP_Fx15(in);
 					break;
 					
+				case 0x0018:
+					this->OP_Fx18(in);
+					break;
+
 				case 0x001E:
-					this->OP_Fx1E();
+					this->OP_Fx1E(in);
 					break;
 				
 				case 0x0029:
-					this->OP_Fx29();
+					this->OP_Fx29(in);
 					break;
 
 				case 0x0033:
-					this->OP_Fx33();
+					this->OP_Fx33(in);
 					break;
 
 				case 0x0055:
-					this->OP_Fx55();
+					this->OP_Fx55(in);
 					break;
 					
 				case 0x0065:
-					this->OP_Fx65();
+					this->OP_Fx65(in);
 					break;
 				
 				default:
-					std::cerr << "0xF000 -> invalid opcode\n";
-					exit(0);
+					LOG_DEBUG("0xF000 -> invalid opcode");
+					this->OP_NULL(in);
 			}
 			break;
 
 		default:
-			std::cerr << "General -> invalid opcode \n";
-			exit(0);
-	}	
+			LOG_DEBUG("General -> invalid opcode");
+			this->OP_NULL(in);
+	}
+}
+
+Chip8::Handler Chip8::Lookup(uint16_t opcode) {
+	return tables.handlers[tables.ids[opcode >> 12u][opcode & 0xFFu]];
+}
+
+Chip8::OpId Chip8::Identify(uint16_t opcode) {
+	return OpId(tables.ids[opcode >> 12u][opcode & 0xFFu]);
+}
+
+/* Table engine: one lookup for the instruction id, one indirect call through the handler table */
+void Chip8::DispatchTable(Instruction const& in) {
+	(this->*tables.handlers[tables.ids[in.opcode >> 12u][in.kk]])(in);
+}
+
+/* Called whenever memory[address .. address + length) is written, so no stale decoded copy of it is executed */
+void Chip8::CodeWritten(uint16_t address, uint16_t length) {
+	address &= MEMSIZE - 1;
+	if (address + length > MEMSIZE) { //the write wrapped around the end of memory: the part at the start goes on its own
+		CodeWritten(0, uint16_t(address + length - MEMSIZE));
+		length = uint16_t(MEMSIZE - address);
+	}
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_CACHED
+	for (unsigned int a = address; a < address + length && a < MEMSIZE; a++) {
+		predecoded[a >> 1u].generation = 0; //the entry holding the instruction that starts at (or straddles) this byte
+	}
+#endif
+
+	if (threaded) {
+		threaded->CodeWritten(address, length);
+	}
+
+#if CHIP8_JIT
+	if (jit) {
+		jit->CodeWritten(address, length);
+	}
+#endif
+}
+
+/* Throws away every decoded instruction (used when a new program is loaded) */
+void Chip8::CodeReset() {
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_CACHED
+	++cacheGeneration; //generation 0 is never current, so explicitly invalidated entries stay invalid
+	if (cacheGeneration == 0) {
+		for (auto& entry : predecoded) {
+			entry.generation = 0;
+		}
+		cacheGeneration = 1;
+	}
+#endif
+
+	if (threaded) {
+		threaded->Translate();
+	}
+
+#if CHIP8_JIT
+	if (jit) {
+		jit->CodeWritten(0, MEMSIZE);
+	}
+#endif
+}
+
+/* Timer ticks are derived from the instruction count: instructionsPerSecond instructions make 60 ticks */
+uint64_t Chip8::Ticks() const {
+	return tickBase + (cycles - cycleBase) * 60u / instructionsPerSecond;
+}
+
+uint8_t Chip8::DelayTimer() const {
+	uint64_t elapsed = Ticks() - delaySetAt;
+	return elapsed >= delayTimer ? 0 : uint8_t(delayTimer - elapsed);
+}
+
+bool Chip8::SoundActive() const {
+	return Ticks() - soundSetAt < soundTimer;
+}
+
+/* Changes the instruction rate without moving the timers (ticks already counted stay counted) */
+void Chip8::SetSpeed(uint32_t ips) {
+	tickBase = Ticks();
+	cycleBase = cycles;
+	instructionsPerSecond = ips ? ips : 1;
+}
+
+void Chip8::Cycle() {
+	/*
+		Steps iterated in each cycle:
+			1. Fetch next cpu instruction from the opcode.
+			2. Decode the instruction to determine which operation needs to take place (done by the dispatch engine chosen at build time).
+			3. Execute the instruction (done in instruction methods below)
+	*/
+
+	if (waitingForKey && !KeyArrived()) { //idle instruction while Fx0A waits
+		++cycles;
+		halt = RunResult::WaitingForKey;
+		return;
+	}
+
+	if (tracer) {
+		tracer->Record(pc, Fetch(pc), I, sp, DelayTimer(), V);
+	}
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_CACHED
+	// Instructions at even addresses come straight out of the predecode cache (fetch and decode are skipped on a hit).
+	// A pc that ran off the end of memory has no entry and takes the wrapping fetch below.
+	if (!(pc & 1u) && pc + 1u < MEMSIZE) {
+		Predecoded& entry = predecoded[pc >> 1u];
+
+		if (entry.generation != cacheGeneration) {
+			entry.in = Decode((memory[pc] << 8u) | memory[pc + 1]);
+			entry.handler = tables.handlers[tables.ids[entry.in.opcode >> 12u][entry.in.kk]];
+			entry.generation = cacheGeneration;
+		}
+
+		opcode = entry.in.opcode;
+		pc += 2;
+		(this->*entry.handler)(entry.in);
+	}
+	else {
+		opcode = Fetch(pc);
+		pc += 2;
+		DispatchTable(Decode(opcode));
+	}
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_CONSTEXPR
+	// Compile-time table engine: one indexed call per opcode, no decoding at all
+	opcode = Fetch(pc);
+	pc += 2;
+	FullOpTable::handlers[opcode](*this, opcode);
+#else
+	// Fetchches instruction 
+	opcode = Fetch(pc); //Get first digit of OP code with a bitmask and shift so it becmes a single digit from $0 to $F
+
+	// For debugging purposes
+	// std::cerr << "Binary: " <<  0xF000 << " | Mem: " << (memory[pc] << 8u) << " | Mem2: " << memory[pc + 1] <<  " | OP Code: " << opcode << " | Both: " << ((opcode & 0xF000)) << "\n";
+
+	// Increment the PC before executing anything (prevents a continuous loop from occuring)
+	pc += 2; 
+	
+	// Decode the operand fields once so the handlers don't have to re-extract them
+	Instruction const in = Decode(opcode);
+#endif
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_GOTO
+	// Computed goto engine: same lookup as the table engine, but jumps straight to a label (GCC/Clang "labels as values").
+	// The labels live in Cycle() itself because GCC will not inline a function that contains a computed goto.
+	static void* const labels[ID_COUNT] = {
+		&&L_NULL, &&L_00E0, &&L_00EE, &&L_1nnn, &&L_2nnn, &&L_3xkk, &&L_4xkk, &&L_5xy0, &&L_6xkk,
+		&&L_7xkk, &&L_8xy0, &&L_8xy1, &&L_8xy2, &&L_8xy3, &&L_8xy4, &&L_8xy5, &&L_8xy6, &&L_8xy7,
+		&&L_8xyE, &&L_9xy0, &&L_Annn, &&L_Bnnn, &&L_Cxkk, &&L_Dxyn, &&L_Ex9E, &&L_ExA1, &&L_Fx07,
+		&&L_Fx0A, &&L_Fx15, &&L_Fx18, &&L_Fx1E, &&L_Fx29, &&L_Fx33, &&L_Fx55, &&L_Fx65
+	};
+
+	goto *labels[tables.ids[in.opcode >> 12u][in.kk]];
+
+	L_NULL: OP_NULL(in); goto executed;
+	L_00E0: OP_00E0(in); goto executed;
+	L_00EE: OP_00EE(in); goto executed;
+	L_1nnn: OP_1nnn(in); goto executed;
+	L_2nnn: OP_2nnn(in); goto executed;
+	L_3xkk: OP_3xkk(in); goto executed;
+	L_4xkk: OP_4xkk(in); goto executed;
+	L_5xy0: OP_5xy0(in); goto executed;
+	L_6xkk: OP_6xkk(in); goto executed;
+	L_7xkk: OP_7xkk(in); goto executed;
+	L_8xy0: OP_8xy0(in); goto executed;
+	L_8xy1: OP_8xy1(in); goto executed;
+	L_8xy2: OP_8xy2(in); goto executed;
+	L_8xy3: OP_8xy3(in); goto executed;
+	L_8xy4: OP_8xy4(in); goto executed;
+	L_8xy5: OP_8xy5(in); goto executed;
+	L_8xy6: OP_8xy6(in); goto executed;
+	L_8xy7: OP_8xy7(in); goto executed;
+	L_8xyE: OP_8xyE(in); goto executed;
+	L_9xy0: OP_9xy0(in); goto executed;
+	L_Annn: OP_Annn(in); goto executed;
+	L_Bnnn: OP_Bnnn(in); goto executed;
+	L_Cxkk: OP_Cxkk(in); goto executed;
+	L_Dxyn: OP_Dxyn(in); goto executed;
+	L_Ex9E: OP_Ex9E(in); goto executed;
+	L_ExA1: OP_ExA1(in); goto executed;
+	L_Fx07: OP_Fx07(in); goto executed;
+	L_Fx0A: OP_Fx0A(in); goto executed;
+	L_Fx15: OP_Fx15(in); goto executed;
+	L_Fx18: OP_Fx18(in); goto executed;
+	L_Fx1E: OP_Fx1E(in); goto executed;
+	L_Fx29: OP_Fx29(in); goto executed;
+	L_Fx33: OP_Fx33(in); goto executed;
+	L_Fx55: OP_Fx55(in); goto executed;
+	L_Fx65: OP_Fx65(in); goto executed;
+executed:
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_TABLE
+	DispatchTable(in);
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_SWITCH
+	DispatchSwitch(in);
+#endif
+
+	// Advance emulated time (the timers are worked out from it when they are read)
+	++cycles;
+}
 
-	// Decrement the delay timer if it's been set
-	if (delayTimer > 0) {
-		--delayTimer;
+/*
+	Runs a batch of instructions in one call. The threaded engine or the JIT run the batch when one is attached,
+	otherwise Chip8::Cycle() is called in a tight loop. Breakpoints need every address checked and the trace is fed by
+	Chip8::Cycle(), so while either is in use the batch is always run one instruction at a time.
+*/
+RunResult Chip8::RunCycles(uint32_t budget) {
+	uint32_t executed = 0;
+	halt = RunResult::Budget;
+
+	// nothing runs while Fx0A waits, the budget passes as idle time in one go
+	if (waitingForKey && !KeyArrived()) {
+		Tick(budget);
+		halt = RunResult::WaitingForKey;
+		return halt;
 	}
 
-	// Decrement the sound timer if it's been set
-	if (soundTimer > 0) {
-		--soundTimer;
+	if (breakpointCount || tracer) {
+		bool resume = resumeAtBreakpoint;
+		resumeAtBreakpoint = false;
+
+		while (executed < budget && halt == RunResult::Budget) {
+			if (breakpoints[pc & (MEMSIZE - 1)] && !(resume && executed == 0)) {
+				halt = RunResult::Breakpoint;
+				resumeAtBreakpoint = true;
+				break;
+			}
+			Cycle();
+			++executed;
+		}
+	}
+#if CHIP8_JIT
+	else if (jit) {
+		executed = jit->Run(budget);
+	}
+#endif
+	else if (threaded) {
+		executed = threaded->Run(budget);
+	}
+	else {
+		while (executed < budget && halt == RunResult::Budget) {
+			Cycle();
+			++executed;
+
+			if ((opcode & 0xF000u) == 0x1000u) { //busy-wait loops are only entered through a jump
+				executed += FastForward(budget - executed);
+			}
+		}
+	}
+
+	return halt;
+}
+
+/* Runs whatever is left of the current frame (a frame stopped early by a breakpoint or Fx0A is picked up again) */
+RunResult Chip8::RunFrame() {
+	// first instruction count at which Ticks() reaches the next tick
+	uint64_t end = cycleBase + ((Ticks() + 1 - tickBase) * instructionsPerSecond + 59u) / 60u;
+	RunResult result = RunCycles(uint32_t(end - cycles));
+
+	// Fx0A on the last instruction of the frame still completes it, the wait is reported by the next call
+	if (cycles >= end && (result == RunResult::Budget || result == RunResult::WaitingForKey)) {
+		result = RunResult::FrameComplete;
+	}
+
+	return result;
+}
+
+/*
+	Recognises the loops ROMs spin in while nothing can change but the timers:
+		1nnn (nnn = its own address) --> jump to itself, spins forever (usually after the game ended)
+		Fx07, 3xkk, 1nnn (nnn = address of Fx07) --> spins until the delay timer reaches kk
+*/
+uint32_t Chip8::IdleLoop(uint16_t address) const {
+	uint16_t self = uint16_t(0x1000u | address); //jump back to the start of the loop
+
+	if (address + 1u >= MEMSIZE) {
+		return 0;
+	}
+	if (((memory[address] << 8u) | memory[address + 1]) == self) {
+		return 1;
+	}
+	if (address + 5u < MEMSIZE && (memory[address] >> 4u) == 0xF && memory[address + 1] == 0x07 &&
+		memory[address + 2] == (0x30u | (memory[address] & 0x0Fu)) && ((memory[address + 4] << 8u) | memory[address + 5]) == self) {
+		return 3;
+	}
+	return 0;
+}
+
+/*
+	Skipped iterations only advance emulated time, so the machine ends up exactly where executing them would have left it.
+	Only whole iterations that can't leave the loop are skipped: the one that leaves it still runs normally.
+*/
+uint32_t Chip8::FastForward(uint32_t budget) {
+	uint32_t length = IdleLoop(pc);
+	if (!length) {
+		return 0;
+	}
+
+	uint64_t iterations = budget / length;
+
+	if (length == 3) {
+		uint8_t kk = memory[pc + 3];
+		uint8_t timer = DelayTimer();
+
+		if (timer == kk) { //leaves the loop this iteration
+			return 0;
+		}
+		if (timer > kk) { //otherwise the timer never gets to kk and the loop spins forever
+			// first instruction count at which the timer reads kk, the iteration whose Fx07 runs from there on leaves
+			uint64_t tick = delaySetAt + delayTimer - kk;
+			uint64_t cycle = cycleBase + ((tick - tickBase) * instructionsPerSecond + 59u) / 60u;
+			iterations = std::min<uint64_t>(iterations, (cycle - cycles + length - 1) / length);
+		}
+	}
+
+	uint32_t skip = uint32_t(iterations * length);
+	if (!skip) {
+		return 0;
+	}
+
+	if (length == 3) { //Fx07 of the last skipped iteration leaves its reading in Vx
+		cycles += skip - length;
+		V[memory[pc] & 0x0Fu] = DelayTimer();
+		cycles += length;
+	}
+	else {
+		cycles += skip;
+	}
+	skippedCycles += skip;
+
+	return skip;
+}
+
+DirtyRect Chip8::TakeDirtyRect() {
+	DirtyRect taken = dirty;
+	dirty = {};
+	return taken;
+}
+
+/* Packs a keypad into a bit per key: every nonzero byte gets its top bit set, then one multiply gathers the eight top bits of a word */
+uint16_t Chip8::KeyMask(uint8_t const* keys) {
+	uint64_t words[2];
+	uint16_t mask = 0;
+
+	memcpy(words, keys, sizeof(words));
+	for (int half = 0; half < 2; half++) {
+		uint64_t w = words[half];
+		w = (((w & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | w) & 0x8080808080808080ull;
+		mask |= uint16_t(((w >> 7u) * 0x0102040810204080ull) >> 56u) << (8 * half);
+	}
+
+	return mask;
+}
+
+bool Chip8::KeyArrived() {
+	uint16_t keys = KeyMask(keypad);
+
+	if (!keys) {
+		return false;
+	}
+
+	V[waitRegister] = uint8_t(__builtin_ctz(keys));
+	waitingForKey = false;
+	return true;
+}
+
+void Chip8::Seed(uint32_t seed) {
+	random = RandomSeed(seed);
+}
+
+/*
+	The generator is std::minstd_rand0 (std::default_random_engine in libstdc++) with bytes drawn the way libstdc++'s
+	std::uniform_int_distribution<uint8_t>(0, 255) draws them, so seeded runs give the same numbers they always have.
+	Its whole state is one word, which is what lets it live in MachineState.
+*/
+uint32_t Chip8::RandomSeed(uint64_t seed) {
+	uint32_t state = seed % 2147483647u;
+	return state ? state : 1;
+}
+
+uint8_t Chip8::RandomByte(uint32_t& state) {
+	const uint32_t scaling = 2147483645u / 256; //outputs per byte value, the last partial group is rejected
+	uint32_t draw;
+
+	do {
+		state = uint64_t(state) * 16807u % 2147483647u;
+		draw = state - 1;
+	} while (draw >= scaling * 256);
+
+	return uint8_t(draw / scaling);
+}
+
+void Chip8::SaveState(MachineState& state) const {
+	memcpy(&state, static_cast<MachineState const*>(this), sizeof(MachineState));
+}
+
+void Chip8::RestoreState(MachineState const& state) {
+	bool codeChanged = memcmp(memory, state.memory, MEMSIZE) != 0; //decoded copies of the old memory would be stale
+	memcpy(static_cast<MachineState*>(this), &state, sizeof(MachineState));
+	resumeAtBreakpoint = false; //a breakpoint on the restored pc stops it like any other
+	++frameVersion; //the host still shows the display from before the restore, make it draw all of it again
+	dirty = {0, 0, VIDEO_WIDTH, VIDEO_HEIGHT};
+
+	if (codeChanged) {
+		CodeReset();
+	}
+}
+
+void Chip8::SetSpriteWrap(bool wrap) {
+	wrapSprites = wrap;
+}
+
+void Chip8::SetBreakpoint(uint16_t address, bool enabled) {
+	bool& breakpoint = breakpoints[address & (MEMSIZE - 1)];
+
+	if (breakpoint != enabled) {
+		breakpoint = enabled;
+		enabled ? ++breakpointCount : --breakpointCount;
 	}
 }
 
 
-/* Chip8 instruction methods (To understand what each operation does, refer to Classes.h) */
+/* Chip8 instruction methods (To understand what each operation does, refer to Chip8.h) */
+
+void Chip8::OP_NULL(Instruction const& in) {
+	LOG_ERROR("Invalid opcode " << std::hex << in.opcode);
+	if (tracer) { //the last instructions that led here
+		tracer->Dump();
+	}
+	pc -= 2; //stay on the opcode so the host can report where it is
+	halt = RunResult::InvalidOpcode;
+}
 
-void Chip8::OP_00E0() {
+void Chip8::OP_00E0(Instruction const&) {
 
-	std::cerr << "00E0\n";
+	LOG_TRACE("00E0");
 
-    memset(video, 0, sizeof(video));
+	videoKernels->clear(video);
+	++frameVersion;
+	dirty = {0, 0, VIDEO_WIDTH, VIDEO_HEIGHT};
 }
 
-void Chip8::OP_00EE() {
+void Chip8::OP_00EE(Instruction const&) {
 
-	std::cerr << "00EE\n";
+	LOG_TRACE("00EE");
 
 	/* 
 		CPUs use a stack to keep track of the order of execution when it calls functions/routines. 
@@ -295,117 +832,117 @@ void Chip8::OP_00EE() {
 	pc = stack[sp]; //resets program counter to reflect new stack position
 }
 
-void Chip8::OP_1nnn() {
+void Chip8::OP_1nnn(Instruction const& in) {
 
-	std::cerr << "1nnn\n";
+	LOG_TRACE("1nnn");
 	/*
 		We want to jump to a different location or register. 
 		This jump does not remember the origin, so there is no stack interaction (notice we did not change "sp")
 	*/
 
 	//NOTE the "u" is added to be 100% sure the number is unsigned
-	uint16_t address = opcode & 0x0FFFu; //conducts binary AND operator to get new address
+	uint16_t address = in.nnn; //nnn is the lower 12 bits of the opcode
 
 	pc = address; //program counter is set to new address
 }
 
-void Chip8::OP_2nnn() {
+void Chip8::OP_2nnn(Instruction const& in) {
 
-	std::cerr << "2nnn\n";
+	LOG_TRACE("2nnn");
 	/*
 		When we call a sub routine, we want to return to the original "calling" routine. 
 	*/
-	uint16_t address = opcode & 0x0FFFu; //defines address of where sub routine will take place
+	uint16_t address = in.nnn; //defines address of where sub routine will take place
 
 	stack[sp] = pc; //stores current routine at the top of the stack
 	++sp; //increments stack pointer to point at the sub routine
 	pc = address; //program counter is set to the address of the sub routine
 }
 
-void Chip8::OP_3xkk() {
+void Chip8::OP_3xkk(Instruction const& in) {
 
-	std::cerr << "3xkk\n";
+	LOG_TRACE("3xkk");
 
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = in.x;
+	uint8_t byte = in.kk;
 
 	if (V[Vx] == byte) {
 		pc += 2;
 	}
 }
 
-void Chip8::OP_4xkk() {
-	std::cerr << "4xkk\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+void Chip8::OP_4xkk(Instruction const& in) {
+	LOG_TRACE("4xkk");
+	uint8_t Vx = in.x;
+	uint8_t byte = in.kk;
 
 	if (V[Vx] != byte) {
 		pc += 2;
 	}
 }
 
-void Chip8::OP_5xy0() {
-	std::cerr << "5xy0\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_5xy0(Instruction const& in) {
+	LOG_TRACE("5xy0");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	if (V[Vx] == V[Vy]) {
 		pc += 2;
 	}
 }
 
-void Chip8::OP_6xkk() {
-	std::cerr << "6xkk\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+void Chip8::OP_6xkk(Instruction const& in) {
+	LOG_TRACE("6xkk");
+	uint8_t Vx = in.x;
+	uint8_t byte = in.kk;
 
 	V[Vx] = byte;
 }
 
-void Chip8::OP_7xkk() {
-	std::cerr << "7xkk\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+void Chip8::OP_7xkk(Instruction const& in) {
+	LOG_TRACE("7xkk");
+	uint8_t Vx = in.x;
+	uint8_t byte = in.kk;
 
 	V[Vx] += byte;
 }
 
-void Chip8::OP_8xy0() {
-	std::cerr << "8xy0\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy0(Instruction const& in) {
+	LOG_TRACE("8xy0");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	V[Vx] = V[Vy];
 }
 
-void Chip8::OP_8xy1() {
-	std::cerr << "8xy1\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy1(Instruction const& in) {
+	LOG_TRACE("8xy1");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	V[Vx] |= V[Vy];
 }
 
-void Chip8::OP_8xy2() {
-	std::cerr << "8xy2\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy2(Instruction const& in) {
+	LOG_TRACE("8xy2");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	V[Vx] &= V[Vy];
 }
 
-void Chip8::OP_8xy3() {
-	std::cerr << "8xy3\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy3(Instruction const& in) {
+	LOG_TRACE("8xy3");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	V[Vx] ^= V[Vy];
 }
 
-void Chip8::OP_8xy4() {
-	std::cerr << "8xy4\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy4(Instruction const& in) {
+	LOG_TRACE("8xy4");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	uint16_t sum = V[Vx] + V[Vy];
 
@@ -419,10 +956,10 @@ void Chip8::OP_8xy4() {
 	V[Vx] = sum & 0xFFu;
 }
 
-void Chip8::OP_8xy5() {
-	std::cerr << "8xy5\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy5(Instruction const& in) {
+	LOG_TRACE("8xy5");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	if (V[Vx] > V[Vy]) {
 		V[0xF] = 1;
@@ -434,9 +971,9 @@ void Chip8::OP_8xy5() {
 	V[Vx] -= V[Vy];
 }
 
-void Chip8::OP_8xy6() {
-	std::cerr << "8xy6\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_8xy6(Instruction const& in) {
+	LOG_TRACE("8xy6");
+	uint8_t Vx = in.x;
 
 	// Save LSB in VF
 	V[0xF] = (V[Vx] & 0x1u);
@@ -444,10 +981,10 @@ void Chip8::OP_8xy6() {
 	V[Vx] >>= 1;
 }
 
-void Chip8::OP_8xy7() {
-	std::cerr << "8xy7\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_8xy7(Instruction const& in) {
+	LOG_TRACE("8xy7");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	if (V[Vy] > V[Vx]) {
 		V[0xF] = 1;
@@ -459,9 +996,9 @@ void Chip8::OP_8xy7() {
 	V[Vx] = V[Vy] - V[Vx];
 }
 
-void Chip8::OP_8xyE() {
-	std::cerr << "8xyE\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_8xyE(Instruction const& in) {
+	LOG_TRACE("8xyE");
+	uint8_t Vx = in.x;
 
 	// Save MSB in VF
 	V[0xF] = (V[Vx] & 0x80u) >> 7u;
@@ -469,74 +1006,87 @@ void Chip8::OP_8xyE() {
 	V[Vx] <<= 1;
 }
 
-void Chip8::OP_9xy0() {
-	std::cerr << "9xy0\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+void Chip8::OP_9xy0(Instruction const& in) {
+	LOG_TRACE("9xy0");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
 
 	if (V[Vx] != V[Vy]) {
 		pc += 2;
 	}
 }
 
-void Chip8::OP_Annn() {
-	std::cerr << "Annn\n";
-	uint16_t address = opcode & 0x0FFFu;
+void Chip8::OP_Annn(Instruction const& in) {
+	LOG_TRACE("Annn");
+	uint16_t address = in.nnn;
 
 	I = address;
 }
 
-void Chip8::OP_Bnnn() {
-	std::cerr << "Bnnn\n";
-	uint16_t address = opcode & 0x0FFFu;
+void Chip8::OP_Bnnn(Instruction const& in) {
+	LOG_TRACE("Bnnn");
+	uint16_t address = in.nnn;
 
 	pc = V[0] + address;
 }
 
-void Chip8::OP_Cxkk() {
-	std::cerr << "Cxkk\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+void Chip8::OP_Cxkk(Instruction const& in) {
+	LOG_TRACE("Cxkk");
+	uint8_t Vx = in.x;
+	uint8_t byte = in.kk;
 
-	V[Vx] = randByte(randGen) & byte;
+	V[Vx] = RandomByte(random) & byte;
 }
 
-void Chip8::OP_Dxyn() {
-	std::cerr << "Dxyn\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-	uint8_t height = opcode & 0x000Fu;
+void Chip8::OP_Dxyn(Instruction const& in) {
+	LOG_TRACE("Dxyn");
+	uint8_t Vx = in.x;
+	uint8_t Vy = in.y;
+	uint8_t height = in.n;
 
 	// Wrap if going beyond screen boundaries
 	uint8_t xPos = V[Vx] % VIDEO_WIDTH;
 	uint8_t yPos = V[Vy] % VIDEO_HEIGHT;
 
-	V[0xF] = 0;
+	// rows the sprite covers: clipped at the bottom edge, or all the way around when wrapping
+	unsigned int rows = wrapSprites ? height : std::min<unsigned int>(height, VIDEO_HEIGHT - yPos);
+	unsigned int above = std::min<unsigned int>(rows, VIDEO_HEIGHT - yPos); //rows before a wrapped sprite comes back in at the top
+	uint8_t sprite[16];
+	uint8_t lit = 0;
 
-	for (unsigned int row = 0; row < height; row++) {
-		uint8_t spriteByte = memory[I + row];
+	for (unsigned int row = 0; row < rows; row++) {
+		sprite[row] = memory[(I + row) & (MEMSIZE - 1)];
+		lit |= sprite[row];
+	}
 
-		for (unsigned int col = 0; col < 8; col++) {
-			uint8_t spritePixel = spriteByte & (0x80u >> col);
-			uint32_t* screenPixel = &video[(yPos + row) * VIDEO_WIDTH + (xPos + col)];
+	// XORs the sprite in a row at a time (see VideoKernels::blit)
+	uint64_t collided = videoKernels->blit(video + yPos, sprite, above, xPos, wrapSprites);
+	collided |= videoKernels->blit(video, sprite + above, rows - above, xPos, wrapSprites);
 
-			// Sprite pixel is on
-			if (spritePixel) {
-				// Screen pixel also on - collision
-				if (*screenPixel == 0xFFFFFFFF) {
-					V[0xF] = 1;
-				}
+	V[0xF] = collided != 0;
+	frameVersion += (wrapSprites ? lit : (uint64_t(lit) << 56u) >> xPos) != 0; //some pixel flipped
 
-				// Effectively XOR with the sprite pixel
-				*screenPixel ^= 0xFFFFFFFF;
-			}
+	// grow the dirty rectangle over the sprite (a wrapped sprite takes whole rows or columns)
+	if (rows) {
+		bool wrapsX = wrapSprites && xPos + 8u > VIDEO_WIDTH;
+		bool wrapsY = yPos + rows > VIDEO_HEIGHT;
+		uint8_t left = wrapsX ? 0 : xPos;
+		uint8_t right = wrapsX ? VIDEO_WIDTH : std::min<unsigned int>(xPos + 8u, VIDEO_WIDTH);
+		uint8_t top = wrapsY ? 0 : yPos;
+		uint8_t bottom = wrapsY ? VIDEO_HEIGHT : yPos + rows;
+
+		if (!dirty.right) {
+			dirty = {left, top, right, bottom};
+		}
+		else {
+			dirty = {std::min(dirty.left, left), std::min(dirty.top, top), std::max(dirty.right, right), std::max(dirty.bottom, bottom)};
 		}
 	}
 }
 
-void Chip8::OP_Ex9E() {
-	std::cerr << "Ex9E\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Ex9E(Instruction const& in) {
+	LOG_TRACE("Ex9E");
+	uint8_t Vx = in.x;
 
 	uint8_t key = V[Vx];
 
@@ -545,9 +1095,9 @@ void Chip8::OP_Ex9E() {
 	}
 }
 
-void Chip8::OP_ExA1() {
-	std::cerr << "ExA1\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_ExA1(Instruction const& in) {
+	LOG_TRACE("ExA1");
+	uint8_t Vx = in.x;
 
 	uint8_t key = V[Vx];
 
@@ -556,131 +1106,94 @@ void Chip8::OP_ExA1() {
 	}
 }
 
-void Chip8::OP_Fx07() {
-	std::cerr << "Fx07\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx07(Instruction const& in) {
+	LOG_TRACE("Fx07");
+	uint8_t Vx = in.x;
 
-	V[Vx] = delayTimer;
+	V[Vx] = DelayTimer();
 }
 
-void Chip8::OP_Fx0A() {
-	std::cerr << "Fx0A\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx0A(Instruction const& in) {
+	LOG_TRACE("Fx0A");
+	uint16_t keys = KeyMask(keypad);
 
-	if (keypad[0]) {
-		V[Vx] = 0;
-	}
-	else if (keypad[1]) {
-		V[Vx] = 1;
-	}
-	else if (keypad[2]) {
-		V[Vx] = 2;
-	}
-	else if (keypad[3]) {
-		V[Vx] = 3;
-	}
-	else if (keypad[4]) {
-		V[Vx] = 4;
-	}
-	else if (keypad[5]) {
-		V[Vx] = 5;
-	}
-	else if (keypad[6]) {
-		V[Vx] = 6;
+	if (keys) {
+		V[in.x] = uint8_t(__builtin_ctz(keys)); //lowest pressed key
 	}
-	else if (keypad[7]) {
-		V[Vx] = 7;
-	}
-	else if (keypad[8]) {
-		V[Vx] = 8;
-	}
-	else if (keypad[9]) {
-		V[Vx] = 9;
-	}
-	else if (keypad[10]) {
-		V[Vx] = 10;
-	}
-	else if (keypad[11]) {
-		V[Vx] = 11;
-	}
-	else if (keypad[12]) {
-		V[Vx] = 12;
-	}
-	else if (keypad[13]) {
-		V[Vx] = 13;
-	}
-	else if (keypad[14]) {
-		V[Vx] = 14;
-	}
-	else if (keypad[15]) {
-		V[Vx] = 15;
-	}
-	else {
-		pc -= 2;
+	else { //the pc already points past Fx0A, the key is stored when the wait ends (see KeyArrived())
+		waitingForKey = true;
+		waitRegister = in.x;
+		halt = RunResult::WaitingForKey;
 	}
 }
 
-void Chip8::OP_Fx15() {
-	std::cerr << "Fx15\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx15(Instruction const& in) {
+	LOG_TRACE("Fx15");
+	uint8_t Vx = in.x;
 
 	delayTimer = V[Vx];
+	delaySetAt = Ticks();
 }
 
-void Chip8::OP_Fx18() {
-	std::cerr << "Fx18\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx18(Instruction const& in) {
+	LOG_TRACE("Fx18");
+	uint8_t Vx = in.x;
 
 	soundTimer = V[Vx];
+	soundSetAt = Ticks();
 }
 
-void Chip8::OP_Fx1E() {
-	std::cerr << "Fx1E\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx1E(Instruction const& in) {
+	LOG_TRACE("Fx1E");
+	uint8_t Vx = in.x;
 
 	I += V[Vx];
 }
 
-void Chip8::OP_Fx29() {
-	std::cerr << "Fx29\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx29(Instruction const& in) {
+	LOG_TRACE("Fx29");
+	uint8_t Vx = in.x;
 	uint8_t digit = V[Vx];
 
 	I = FONTSET_START_ADD + (5 * digit);
 }
 
-void Chip8::OP_Fx33() {
-	std::cerr << "Fx33\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u; //the >> operator means shift along the binary
+void Chip8::OP_Fx33(Instruction const& in) {
+	LOG_TRACE("Fx33");
+	uint8_t Vx = in.x; //x is the second nibble of the opcode
 	uint8_t value = V[Vx];
 
-	// Ones-place
-	memory[I + 2] = value % 10;
+	// Ones-place (I can point anywhere in 16 bits, addresses wrap around the end of memory as in Dxyn)
+	memory[(I + 2) & (MEMSIZE - 1)] = value % 10;
 	value /= 10;
 
 	// Tens-place
-	memory[I + 1] = value % 10;
+	memory[(I + 1) & (MEMSIZE - 1)] = value % 10;
 	value /= 10;
 
 	// Hundreds-place
-	memory[I] = value % 10;
+	memory[I & (MEMSIZE - 1)] = value % 10;
+
+	CodeWritten(I, 3);
 }
 
-void Chip8::OP_Fx55() {
-	std::cerr << "Fx55\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx55(Instruction const& in) {
+	LOG_TRACE("Fx55");
+	uint8_t Vx = in.x;
 
 	for (uint8_t i = 0; i <= Vx; i++) {
-		memory[I + i] = V[i];
+		memory[(I + i) & (MEMSIZE - 1)] = V[i];
 	}
+
+	CodeWritten(I, Vx + 1);
 }
 
-void Chip8::OP_Fx65() {
-	std::cerr << "Fx65\n";
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+void Chip8::OP_Fx65(Instruction const& in) {
+	LOG_TRACE("Fx65");
+	uint8_t Vx = in.x;
 
 	for (uint8_t i = 0; i <= Vx; i++) {
-		V[i] = memory[I + i];
+		V[i] = memory[(I + i) & (MEMSIZE - 1)];
 	}
 }
 
@@ -0,0 +1,271 @@
+//
+// Created by Dhruv Rawat on 2020-07-08.
+//
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <type_traits>
+#include <vector>
+#include <cstring>
+#include <fstream> //input output stream class to operate on files
+
+#ifndef CHIP_8_H
+#define CHIP_8_H
+
+/* other constants */
+const unsigned int VIDEO_HEIGHT = 32;
+const unsigned int VIDEO_WIDTH = 64;
+const unsigned int  MEMSIZE = 0x1000;
+const unsigned int START_ADD = 0x200; //start address for the program counter
+const unsigned int FONTSET_START_ADD = 0x50; //where the font sprites are loaded
+
+/*
+    Dispatch engines used by Chip8::Cycle(). Pick one at build time with -DCHIP8_DISPATCH=<value>:
+        CHIP8_DISPATCH_SWITCH --> nested switch on the opcode families (reference path)
+        CHIP8_DISPATCH_TABLE --> precomputed handler table
+        CHIP8_DISPATCH_GOTO --> computed goto, GCC/Clang only
+        CHIP8_DISPATCH_CACHED --> predecoded instruction cache keyed by pc, table engine on a miss (default)
+        CHIP8_DISPATCH_CONSTEXPR --> compile-time generated table of 65536 template handlers (see OpTable.h)
+*/
+#define CHIP8_DISPATCH_SWITCH 0
+#define CHIP8_DISPATCH_TABLE 1
+#define CHIP8_DISPATCH_GOTO 2
+#define CHIP8_DISPATCH_CACHED 3
+#define CHIP8_DISPATCH_CONSTEXPR 4
+
+#ifndef CHIP8_DISPATCH
+#define CHIP8_DISPATCH CHIP8_DISPATCH_CACHED
+#endif
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_GOTO && !defined(__GNUC__)
+#error "CHIP8_DISPATCH_GOTO needs the GCC/Clang labels-as-values extension"
+#endif
+
+//Set CHIP8_JIT to 1 to build the x86-64 basic block compiler (see Jit.h)
+#ifndef CHIP8_JIT
+#define CHIP8_JIT 0
+#endif
+
+#if CHIP8_JIT && !defined(__x86_64__)
+#error "CHIP8_JIT only targets x86-64"
+#endif
+
+class Jit;
+template<unsigned int> class Lockstep;
+class Threaded;
+class Tracer;
+
+//An opcode split into its operand fields (decoded once, read by the instruction methods)
+struct Instruction {
+    uint16_t opcode; //the full two byte opcode
+    uint16_t nnn; //lowest 12 bits (address)
+    uint8_t x; //lower 4 bits of the high byte (register index)
+    uint8_t y; //upper 4 bits of the low byte (register index)
+    uint8_t n; //lowest 4 bits (nibble)
+    uint8_t kk; //lowest 8 bits (byte)
+};
+
+//why Chip8::RunCycles() or Chip8::RunFrame() returned
+enum class RunResult : uint8_t {
+    Budget, //ran every instruction it was asked to
+    WaitingForKey, //Fx0A found no key pressed (the pc stays on it)
+    InvalidOpcode, //unknown opcode (the pc stays on it)
+    Breakpoint, //the pc reached a breakpoint, the instruction there has not run yet
+    FrameComplete //RunFrame() ran the rest of the frame
+};
+
+//region of video changed since the host last took it (see Chip8::TakeDirtyRect())
+struct DirtyRect {
+    uint8_t left, top; //first changed column and row
+    uint8_t right, bottom; //one past the last changed column and row (the rectangle is empty when right is 0)
+};
+
+/*
+    Everything a running machine is, in one plain block of memory: registers, timers, RAM, keypad, display and the
+    random number generator. Chip8 keeps it as its base, so a snapshot is one memcpy of sizeof(MachineState) bytes each
+    way (see Chip8::SaveState()). Caches, breakpoints and attached engines are not part of it.
+
+    No default member initializers, so the struct stays a POD and a derived class never packs its own members into the
+    tail padding that memcpy overwrites. Chip8 value-initializes it and sets the non-zero fields in its constructor.
+*/
+struct alignas(64) MachineState {
+    uint8_t V[16]; //CPU registers (V0 to VF) (8-bit general purpose registers)
+    uint16_t I; //index register (value ranges from 0x000 to 0xFFF)
+    uint16_t pc; //program counter (value ranges from 0x000 to 0xFFF)
+    uint16_t opcode; //Current op code (needs to store two bytes)
+
+    //Stack used to remember the current location before a jump to an address or subroutine is performed
+    uint16_t stack[16];
+    uint8_t sp; //used to remember which level of the stack is used to store the current location
+
+    /*
+        Timer registers that count down at 60 Hz of emulated time. Nothing is decremented while instructions run: a timer
+        keeps the value it was set to and the tick it was set on, and its current value is worked out when it is read.
+        Emulated time is the number of instructions executed, so the timers keep their speed at any instruction rate.
+    */
+    uint8_t delayTimer; //value the delay timer was last set to
+    uint8_t soundTimer; //value the sound timer was last set to (system buzzer sounds while it is running)
+    uint64_t delaySetAt; //tick the delay timer was set on
+    uint64_t soundSetAt; //tick the sound timer was set on
+
+    uint64_t cycles; //instructions executed since power on
+    uint32_t instructionsPerSecond; //emulated instruction rate (600 at power on, 10 instructions per 60 Hz tick)
+    uint64_t cycleBase; //cycle count when the rate was last changed
+    uint64_t tickBase; //tick count when the rate was last changed
+    uint64_t skippedCycles; //instructions of busy-wait loops that were skipped instead of executed (included in "cycles")
+
+    uint32_t frameVersion; //bumped by every instruction that changes video (00E0 and Dxyn)
+    DirtyRect dirty; //union of the pixels drawn since the host last took it
+    bool wrapSprites; //Dxyn wraps sprites around the screen edges instead of clipping them
+
+    bool waitingForKey; //Fx0A found no key pressed, nothing runs until one is (emulated time still passes)
+    uint8_t waitRegister; //register that gets the key Fx0A is waiting for
+
+    uint32_t random; //state of the random number generator of Cxkk (minstd_rand0, see Chip8::RandomByte())
+
+    uint8_t keypad[16]; //Hex based keypad (0x0 to 0xF)
+    uint64_t video[VIDEO_HEIGHT]; //Black and white graphics, one bit per pixel and one word per row (bit 63 is the leftmost column, see Video.h to draw it)
+    uint8_t memory[MEMSIZE]; //Memory (Chip 8 has 4K memory in total)
+};
+
+static_assert(std::is_trivially_copyable<MachineState>::value && std::is_standard_layout<MachineState>::value,
+    "MachineState is saved and restored with memcpy");
+
+class Chip8 : private MachineState {
+private:
+    friend class Jit; //compiled blocks read and write the registers directly
+    friend class Threaded; //threaded code runs the register operations itself
+    template<size_t...> friend struct OpTable; //takes the addresses of the Exec<> handlers
+    friend class Profiler; //reads the executed opcodes (profile.cpp)
+    friend class Tracer; //attaches itself to the machine
+    template<unsigned int> friend class Lockstep; //copies the loaded memory into its lanes
+
+    typedef void (Chip8::*Handler)(Instruction const&); //pointer to an instruction method
+
+    //ids of the leaf instructions, used to index the dispatch tables
+    enum OpId : uint8_t {
+        ID_NULL, ID_00E0, ID_00EE, ID_1nnn, ID_2nnn, ID_3xkk, ID_4xkk, ID_5xy0, ID_6xkk,
+        ID_7xkk, ID_8xy0, ID_8xy1, ID_8xy2, ID_8xy3, ID_8xy4, ID_8xy5, ID_8xy6, ID_8xy7,
+        ID_8xyE, ID_9xy0, ID_Annn, ID_Bnnn, ID_Cxkk, ID_Dxyn, ID_Ex9E, ID_ExA1, ID_Fx07,
+        ID_Fx0A, ID_Fx15, ID_Fx18, ID_Fx1E, ID_Fx29, ID_Fx33, ID_Fx55, ID_Fx65, ID_COUNT
+    };
+
+    struct Tables; //decode and handler tables (defined in Chip8.cpp)
+    static const Tables tables;
+
+    //predecoded instruction for one even address (only used by CHIP8_DISPATCH_CACHED)
+    struct Predecoded {
+        Handler handler; //instruction method to run
+        Instruction in; //operand fields already extracted
+        uint32_t generation; //entry is valid while this matches cacheGeneration
+    };
+
+    Predecoded predecoded[MEMSIZE / 2] = {}; //one entry per even address (2048 entries)
+    uint32_t cacheGeneration = 1; //bumped to invalidate every entry at once
+
+    RunResult halt = RunResult::Budget; //set by an instruction method that has to end the current batch
+
+    bool breakpoints[MEMSIZE] = {};
+    unsigned int breakpointCount = {};
+    bool resumeAtBreakpoint = {}; //the last batch stopped on a breakpoint at the pc, run it this time
+
+    Jit* jit = {}; //compiler attached to this machine (told about code writes)
+    Threaded* threaded = {}; //threaded code translator attached to this machine (told about code writes)
+    Tracer* tracer = {}; //instruction trace attached to this machine (fed by Cycle())
+
+    static Instruction Decode(uint16_t); //splits an opcode into its operand fields
+    static Handler Lookup(uint16_t); //instruction method that executes an opcode
+    static OpId Identify(uint16_t); //leaf instruction of an opcode
+    template<uint16_t> static void Exec(Chip8&, uint16_t); //handler with the register fields of an opcode baked in (OpTable.h)
+    void DispatchSwitch(Instruction const&); //executes an instruction through the nested switch
+    void DispatchTable(Instruction const&); //executes an instruction through the handler table
+    void CodeWritten(uint16_t, uint16_t); //drops decoded copies of memory that was just written (a write past the end wraps to 0)
+    void CodeReset(); //drops every decoded instruction
+    void Tick(uint32_t n) { cycles += n; } //accounts for instructions run by an engine that doesn't go through Cycle()
+    uint64_t Ticks() const; //60 Hz timer ticks since power on
+    uint8_t DelayTimer() const; //current value of the delay timer
+    //opcode at an address, wrapping around the end of memory (a pc can run past 0xFFE, it is only 16 bits)
+    uint16_t Fetch(uint16_t address) const { return (memory[address & (MEMSIZE - 1)] << 8u) | memory[(address + 1u) & (MEMSIZE - 1)]; }
+    static uint16_t KeyMask(uint8_t const*); //bit per pressed key of a keypad
+    static uint32_t RandomSeed(uint64_t); //generator state for a seed (as std::minstd_rand0::seed())
+    static uint8_t RandomByte(uint32_t&); //next byte of a generator (as std::uniform_int_distribution<uint8_t>(0, 255))
+    bool KeyArrived(); //ends an Fx0A wait if a key is pressed now
+    uint32_t IdleLoop(uint16_t) const; //instructions in the busy-wait loop starting at an address (0 if it isn't one)
+    uint32_t FastForward(uint32_t); //skips whole iterations of the busy-wait loop at the pc, returns the cycles skipped
+
+    //Chip-8 instructions are emulated in these methods (the operands come pre-decoded in the Instruction)
+    void OP_NULL(Instruction const&); //invalid opcode
+    void OP_00E0(Instruction const&); //clear the display
+    void OP_00EE(Instruction const&); //return from a subroutine
+    void OP_1nnn(Instruction const&); //jump to location "nnn" (interpreter sets program counter to "nnn")
+    void OP_2nnn(Instruction const&); //call subroutine at "nnn"
+    void OP_3xkk(Instruction const&); //skips instruction if Vx = kk
+    void OP_4xkk(Instruction const&); //skip next instruction if Vx != kk
+    void OP_5xy0(Instruction const&); //skip next instruction if Vx != Vy
+    void OP_6xkk(Instruction const&); //set Vx == kk
+    void OP_7xkk(Instruction const&); //set Vx = Vx + kk
+    void OP_8xy0(Instruction const&); //set Vx == Vy
+    void OP_8xy1(Instruction const&); //set Vx == Vy OR Vx
+    void OP_8xy2(Instruction const&); //set Vx == Vy AND Vx
+    void OP_8xy3(Instruction const&); //set Vx == Vy XOR Vx
+    void OP_8xy4(Instruction const&); //set Vx = Vx + Vy, set VF = carry
+    void OP_8xy5(Instruction const&); //set Vx = Vx + Vy, set VF = NOT borrow
+    void OP_8xy6(Instruction const&); //set Vx = Vx SHR 1
+    void OP_8xy7(Instruction const&); //set Vx = Vy - Vx, seet VF = NOT borrow
+    void OP_8xyE(Instruction const&); //set Vx = Vx SHL 1
+    void OP_9xy0(Instruction const&); //skip next instruction if Vx != Vy]
+    void OP_Annn(Instruction const&); //set I = nnn
+    void OP_Bnnn(Instruction const&); //jump to location nnn + V0
+    void OP_Cxkk(Instruction const&); //set Vx = random byte AND kk
+    void OP_Dxyn(Instruction const&); // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision
+    void OP_Ex9E(Instruction const&); //skip next instruction if key with the value of Vx is pressed
+    void OP_ExA1(Instruction const&); //skip next instruction if key with the value of Vx is not pressed
+    void OP_Fx07(Instruction const&); //set Vx = delay timer value
+    void OP_Fx0A(Instruction const&); //wait for a key press, store the value of the key in Vx
+    void OP_Fx15(Instruction const&); //set delay timer = Vx
+    void OP_Fx18(Instruction const&); //set sound timer = Vx
+    void OP_Fx1E(Instruction const&); //set I = I + Vx
+    void OP_Fx29(Instruction const&); //Set I = location of sprite for digit Vx
+    void OP_Fx33(Instruction const&); //Store BCD representation of Vx in memory locations I, I+1, and I+2
+    void OP_Fx55(Instruction const&); //store registers V0 through Vx in memory starting at location I
+    void OP_Fx65(Instruction const&); //read registers V0 through Vx from memory starting at location I
+
+public:
+    Chip8();
+    static void* operator new(size_t); //MachineState wants a cache line of its own, which plain new doesn't give before C++17
+    static void operator delete(void*);
+    bool loadROM(char const*); //false (and nothing loaded) if the file can't be read or doesn't fit in memory
+    void Cycle();
+    RunResult RunCycles(uint32_t); //runs up to the given number of instructions through the fastest attached engine
+    RunResult RunFrame(); //runs until the next 60 Hz tick (the end of the current frame)
+    void SetBreakpoint(uint16_t, bool); //stops RunCycles()/RunFrame() before the instruction at an address runs
+    void SetSpriteWrap(bool); //sprites drawn past an edge wrap around to the other side (clipped by default)
+    void Seed(uint32_t); //reseeds the random number generator of Cxkk, so a run can be repeated exactly
+    void SetSpeed(uint32_t); //instructions per second of emulated time (the timers and frames stay at 60 Hz)
+    bool SoundActive() const; //the sound timer is still running
+    uint32_t FrameVersion() const { return frameVersion; } //changes whenever video does, so a host can skip redrawing an unchanged frame
+    DirtyRect TakeDirtyRect(); //part of video changed since the last call, so a host can upload only that
+    uint64_t Cycles() const { return cycles; } //instructions executed since power on (emulated time)
+    bool Halted() const { return IdleLoop(pc) == 1; } //the pc sits on a jump to itself, only a reset gets it out
+    uint64_t SkippedCycles() const { return skippedCycles; } //busy-wait instructions fast-forwarded over since power on
+    bool WaitingForKey() const { return waitingForKey; } //Fx0A is waiting, the host can sleep until a key is pressed
+    void SaveState(MachineState&) const; //copies the whole machine out (one memcpy)
+    void RestoreState(MachineState const&); //puts a saved machine back (one memcpy, decoded code is dropped if memory differs, the display is redrawn)
+    std::vector<uint8_t> SaveStateBytes() const; //the machine in the versioned state file format (State.cpp)
+    bool LoadStateBytes(uint8_t const*, size_t); //restores a machine from SaveStateBytes(), false and unchanged if it can't
+    bool SaveStateFile(char const*) const; //writes SaveStateBytes() to a file, false if it can't
+    bool LoadStateFile(char const*); //restores a machine written by SaveStateFile(), false and unchanged if it can't
+
+    //the host reads and writes these directly (they live in MachineState)
+    using MachineState::keypad;
+    using MachineState::video;
+};
+
+//a host switch given in the environment (CHIP8_WRAP=1): on unless it is unset, empty or "0"
+inline bool EnvironmentFlag(char const* name) {
+    char const* value = std::getenv(name);
+    return value && *value && std::strcmp(value, "0") != 0;
+}
+
+#endif
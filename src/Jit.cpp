@@ -0,0 +1,661 @@
+//
+// x86-64 code generation for the basic block compiler (see Jit.h)
+//
+
+#include "Jit.h"
+#include "Log.h"
+
+#if CHIP8_JIT
+
+#include <cstddef>
+#include <sys/mman.h>
+
+namespace {
+
+/* x86-64 register numbers */
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* condition codes for jcc/setcc */
+enum Cond { CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xC };
+
+/* host registers the V registers and I are cached in (rbx holds the Chip8, r15 the context, rax/rcx/rdx are scratch) */
+const int POOL[] = { RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14 };
+const unsigned int POOL_SIZE = sizeof(POOL) / sizeof(POOL[0]);
+
+/* Minimal x86-64 encoder. Register operations are 32 bit, so cached values always stay zero extended. */
+class Emitter {
+public:
+	uint8_t* p;
+
+	explicit Emitter(uint8_t* start) : p(start) {}
+
+	void Byte(uint8_t b) { *p++ = b; }
+	void Word(uint16_t w) { memcpy(p, &w, 2); p += 2; }
+	void Dword(uint32_t d) { memcpy(p, &d, 4); p += 4; }
+	void Qword(uint64_t q) { memcpy(p, &q, 8); p += 8; }
+
+	// REX prefix (force is needed to use sil/dil/bpl as byte registers)
+	void Rex(bool w, int reg, int base, bool force = false) {
+		uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+		if (rex != 0x40 || force) {
+			Byte(rex);
+		}
+	}
+
+	// ModRM (and SIB for r12) for [base + disp32]
+	void Mem(int reg, int base, int32_t disp) {
+		Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == RSP) {
+			Byte(0x24);
+		}
+		Dword(disp);
+	}
+
+	void RR(uint8_t op, int dst, int src) { Rex(false, src, dst); Byte(op); Byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+	void Mov(int dst, int src) { if (dst != src) RR(0x89, dst, src); }
+	void Add(int dst, int src) { RR(0x01, dst, src); }
+	void Or(int dst, int src) { RR(0x09, dst, src); }
+	void And(int dst, int src) { RR(0x21, dst, src); }
+	void Sub(int dst, int src) { RR(0x29, dst, src); }
+	void Xor(int dst, int src) { RR(0x31, dst, src); }
+	void Cmp(int a, int b) { RR(0x39, a, b); }
+
+	void Imm(int ext, int dst, uint32_t imm) { Rex(false, 0, dst); Byte(0x81); Byte(0xC0 | (ext << 3) | (dst & 7)); Dword(imm); }
+	void AddImm(int dst, uint32_t imm) { Imm(0, dst, imm); }
+	void AndImm(int dst, uint32_t imm) { Imm(4, dst, imm); }
+	void CmpImm(int dst, uint32_t imm) { Imm(7, dst, imm); }
+	void MovImm(int dst, uint32_t imm) { Rex(false, 0, dst); Byte(0xB8 + (dst & 7)); Dword(imm); }
+
+	void Shift(int ext, int dst, uint8_t count) { Rex(false, 0, dst); Byte(0xC1); Byte(0xC0 | (ext << 3) | (dst & 7)); Byte(count); }
+	void Shl(int dst, uint8_t count) { Shift(4, dst, count); }
+	void Shr(int dst, uint8_t count) { Shift(5, dst, count); }
+
+	// eax = condition ? 1 : 0
+	void SetFlag(Cond cc) {
+		Byte(0x0F); Byte(0x90 | cc); Byte(0xC0); //setcc al
+		Byte(0x0F); Byte(0xB6); Byte(0xC0); //movzx eax, al
+	}
+
+	void LoadByte(int dst, int base, int32_t disp) { Rex(false, dst, base); Byte(0x0F); Byte(0xB6); Mem(dst, base, disp); }
+	void LoadWord(int dst, int base, int32_t disp) { Rex(false, dst, base); Byte(0x0F); Byte(0xB7); Mem(dst, base, disp); }
+	void StoreByte(int base, int32_t disp, int src) { Rex(false, src, base, true); Byte(0x88); Mem(src, base, disp); }
+	void StoreWord(int base, int32_t disp, int src) { Byte(0x66); Rex(false, src, base); Byte(0x89); Mem(src, base, disp); }
+	void StoreWordImm(int base, int32_t disp, uint16_t imm) { Byte(0x66); Rex(false, 0, base); Byte(0xC7); Mem(0, base, disp); Word(imm); }
+	void AddMem(int base, int32_t disp, int32_t imm) { Rex(false, 0, base); Byte(0x81); Mem(0, base, disp); Dword(imm); }
+	void SubMem(int base, int32_t disp, int32_t imm) { Rex(false, 0, base); Byte(0x81); Mem(5, base, disp); Dword(imm); }
+	void IncByte(int base, int32_t disp) { Rex(false, 0, base); Byte(0xFE); Mem(0, base, disp); }
+	void DecByte(int base, int32_t disp) { Rex(false, 0, base); Byte(0xFE); Mem(1, base, disp); }
+
+	// stack[rax] accesses: [rbx + rax * 2 + disp]
+	void StoreStackImm(int32_t disp, uint16_t imm) { Byte(0x66); Byte(0xC7); Byte(0x84); Byte(0x43); Dword(disp); Word(imm); }
+	void LoadStack(int32_t disp) { Byte(0x0F); Byte(0xB7); Byte(0x84); Byte(0x43); Dword(disp); } //movzx eax, word [...]
+
+	void Mov64(int dst, int src) { Rex(true, src, dst); Byte(0x89); Byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+	void MovImm64(int dst, uint64_t imm) { Rex(true, 0, dst); Byte(0xB8 + (dst & 7)); Qword(imm); }
+	void Push(int reg) { Rex(false, 0, reg); Byte(0x50 + (reg & 7)); }
+	void Pop(int reg) { Rex(false, 0, reg); Byte(0x58 + (reg & 7)); }
+	void CallReg(int reg) { Rex(false, 0, reg); Byte(0xFF); Byte(0xD0 | (reg & 7)); }
+	void TestEax() { Byte(0x85); Byte(0xC0); }
+	void Ret() { Byte(0xC3); }
+
+	// jumps return the address of their rel32 operand so they can be patched later
+	uint8_t* Jump() { Byte(0xE9); Dword(0); return p - 4; }
+	uint8_t* JumpIf(Cond cc) { Byte(0x0F); Byte(0x80 | cc); Dword(0); return p - 4; }
+
+	static void Patch(uint8_t* site, uint8_t const* target) {
+		int32_t rel = int32_t(target - (site + 4));
+		memcpy(site, &rel, 4);
+	}
+};
+
+/* How an instruction is compiled */
+enum Kind {
+	K_INLINE, //register arithmetic emitted as machine code
+	K_HELPER, //runs through the Chip8 instruction method, the block continues afterwards
+	K_SKIP, //3xkk, 4xkk, 5xy0, 9xy0: ends the block with two chained exits
+	K_JUMP, //1nnn: ends the block with one chained exit
+	K_CALL, //2nnn: pushes the return address, ends the block with one chained exit
+	K_RETURN, //00EE: ends the block, target comes from the stack
+	K_JUMP_V0, //Bnnn: ends the block, target depends on V0
+	K_HELPER_END //Ex9E, ExA1, Fx0A and invalid opcodes: runs through the Chip8 method, then ends the block
+};
+
+/* Mirrors the decoding done by Chip8::DispatchSwitch() */
+Kind Classify(Instruction const& in) {
+	switch (in.opcode >> 12u) {
+		case 0x0:
+			if (in.kk == 0xE0) return K_HELPER;
+			if (in.kk == 0xEE) return K_RETURN;
+			return K_HELPER_END;
+		case 0x1: return K_JUMP;
+		case 0x2: return K_CALL;
+		case 0x3: case 0x4: case 0x5: case 0x9: return K_SKIP;
+		case 0x6: case 0x7: case 0xA: return K_INLINE;
+		case 0x8: return (in.n <= 0x7 || in.n == 0xE) ? K_INLINE : K_HELPER_END;
+		case 0xB: return K_JUMP_V0;
+		case 0xC: case 0xD: return K_HELPER;
+		case 0xE: return K_HELPER_END;
+		default: //0xF
+			switch (in.kk) {
+				case 0x1E: return K_INLINE;
+				case 0x07: case 0x15: case 0x18: case 0x29: case 0x33: case 0x55: case 0x65: return K_HELPER;
+				default: return K_HELPER_END;
+			}
+	}
+}
+
+/* V registers (bit per register) and I read or written by the code emitted for an instruction */
+struct Use {
+	uint16_t regs;
+	uint16_t writes;
+	bool i;
+};
+
+Use UseOf(Instruction const& in, Kind kind) {
+	Use use = { 0, 0, false };
+	uint16_t x = 1u << in.x, y = 1u << in.y, f = 1u << 0xF;
+
+	switch (in.opcode >> 12u) {
+		case 0x3: case 0x4: use.regs = x; break;
+		case 0x5: case 0x9: use.regs = x | y; break;
+		case 0x6: case 0x7: use.regs = use.writes = x; break;
+		case 0x8:
+			if (kind == K_INLINE) {
+				bool flag = in.n >= 0x4;
+				use.regs = x | y | (flag ? f : 0);
+				use.writes = x | (flag ? f : 0);
+			}
+			break;
+		case 0xA: use.i = true; break;
+		case 0xB: use.regs = 1u; break;
+		case 0xF:
+			if (kind == K_INLINE) { //Fx1E
+				use.regs = x;
+				use.i = true;
+			}
+			break;
+	}
+	return use;
+}
+
+}
+
+Jit::Jit(Chip8& c) : chip(c) {
+	void* memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) { //stays detached, so Chip8::RunCycles() keeps using the threaded engine or Cycle()
+		LOG_ERROR("JIT: no executable memory, running without the compiler");
+		return;
+	}
+	arena = static_cast<uint8_t*>(memory);
+
+	uint8_t* base = reinterpret_cast<uint8_t*>(&chip);
+	offV = int32_t(reinterpret_cast<uint8_t*>(chip.V) - base);
+	offI = int32_t(reinterpret_cast<uint8_t*>(&chip.I) - base);
+	offPc = int32_t(reinterpret_cast<uint8_t*>(&chip.pc) - base);
+	offSp = int32_t(reinterpret_cast<uint8_t*>(&chip.sp) - base);
+	offStack = int32_t(reinterpret_cast<uint8_t*>(chip.stack) - base);
+
+	// enter(chip, context, code): saves the callee-saved registers, loads the base registers and calls into a block.
+	// The six pushes leave the stack 16-byte aligned inside blocks, so blocks can call helpers directly.
+	Emitter e(arena);
+	const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+	for (int reg : saved) {
+		e.Push(reg);
+	}
+	e.Mov64(RBX, RDI);
+	e.Mov64(R15, RSI);
+	e.CallReg(RDX);
+	for (int i = 5; i >= 0; i--) {
+		e.Pop(saved[i]);
+	}
+	e.Ret();
+
+	enter = reinterpret_cast<void (*)(Chip8*, Context*, uint8_t*)>(arena);
+	blockCode = cursor = e.p;
+	chip.jit = this;
+}
+
+Jit::~Jit() {
+	if (!arena) {
+		return;
+	}
+	chip.jit = nullptr;
+	munmap(arena, ARENA_SIZE);
+}
+
+uint32_t Jit::Run(uint32_t budget) {
+	uint32_t executed = 0;
+	chip.halt = RunResult::Budget;
+	bool leader = true; //the pc was reached by a jump, so it starts a block
+
+	while (executed < budget && chip.halt == RunResult::Budget) { //Fx0A and invalid opcodes end the batch early
+		uint16_t pc = chip.pc;
+		Block* block = pc < MEMSIZE ? blocks[pc] : nullptr;
+
+		// busy-wait loops are never compiled (they would spin inside a chained block), they are skipped from here
+		uint32_t idle = !block && leader ? chip.IdleLoop(pc) : 0;
+
+		if (idle) {
+			uint32_t skipped = chip.FastForward(budget - executed);
+			if (skipped) {
+				executed += skipped;
+				continue;
+			}
+		}
+		else if (!block && leader && pc < MEMSIZE && ++hits[pc] >= JIT_THRESHOLD) {
+			block = Compile(pc);
+		}
+
+		if (block) {
+			uint32_t left = budget - executed;
+			context.budget = int32_t(left > 0x7FFFFFFFu ? 0x7FFFFFFFu : left);
+			context.pending = 0;
+			int32_t given = context.budget;
+
+			enter(&chip, &context, block->entry);
+
+			chip.Tick(context.pending);
+			uint32_t ran = uint32_t(given - context.budget);
+			if (ran > 0) {
+				executed += ran;
+				leader = true;
+				continue;
+			}
+			// the block is longer than the remaining budget, finish in the interpreter
+		}
+
+		chip.Cycle();
+		++executed;
+		leader = chip.pc != uint16_t(pc + 2);
+	}
+
+	return executed;
+}
+
+Jit::Block* Jit::Compile(uint16_t start) {
+	if (size_t(arena + ARENA_SIZE - cursor) < MAX_BLOCK_BYTES) {
+		Flush();
+	}
+
+	// Pass 1: collect the block and give every V register (and I) it uses inline a host register
+	std::vector<Instruction> code;
+	std::vector<Kind> kinds;
+	int host[16];
+	int hostI = -1;
+	uint16_t cached = 0, written = 0;
+	bool writtenI = false;
+	unsigned int used = 0;
+
+	for (int& reg : host) {
+		reg = -1;
+	}
+
+	uint16_t address = start;
+	while (code.size() < MAX_BLOCK && address + 1u < MEMSIZE) {
+		Instruction in = Chip8::Decode((chip.memory[address] << 8u) | chip.memory[address + 1]);
+		Kind kind = Classify(in);
+		Use use = UseOf(in, kind);
+
+		unsigned int extra = 0;
+		for (int v = 0; v < 16; v++) {
+			extra += ((use.regs & ~cached) >> v) & 1u;
+		}
+		extra += (use.i && hostI < 0) ? 1 : 0;
+		if (used + extra > POOL_SIZE) {
+			break; //out of host registers, the next block picks up from here
+		}
+
+		for (int v = 0; v < 16; v++) {
+			if ((use.regs >> v) & 1u && host[v] < 0) {
+				host[v] = POOL[used++];
+			}
+		}
+		if (use.i && hostI < 0) {
+			hostI = POOL[used++];
+		}
+		cached |= use.regs;
+		written |= use.writes;
+		writtenI |= use.i;
+
+		code.push_back(in);
+		kinds.push_back(kind);
+		address += 2;
+
+		if (kind >= K_SKIP) {
+			break;
+		}
+	}
+
+	if (code.empty()) {
+		return nullptr;
+	}
+
+	// Pass 2: emit the machine code
+	std::unique_ptr<Block> owned(new Block());
+	Block* block = owned.get();
+	block->start = start;
+	block->end = address;
+	block->valid = true;
+	block->helpers.reserve(code.size()); //helpers hold pointers into this vector, so it must never reallocate
+
+	const int32_t budgetAt = offsetof(Context, budget);
+	const int32_t pendingAt = offsetof(Context, pending);
+	const uint32_t n = uint32_t(code.size());
+	uint32_t synced = 0; //instructions already added to context.pending on the current path
+
+	Emitter e(cursor);
+	block->entry = e.p;
+
+	auto load = [&]() {
+		for (int v = 0; v < 16; v++) {
+			if (host[v] >= 0) {
+				e.LoadByte(host[v], RBX, offV + v);
+			}
+		}
+		if (hostI >= 0) {
+			e.LoadWord(hostI, RBX, offI);
+		}
+	};
+
+	auto writeBack = [&]() {
+		for (int v = 0; v < 16; v++) {
+			if ((written >> v) & 1u) {
+				e.StoreByte(RBX, offV + v, host[v]);
+			}
+		}
+		if (writtenI) {
+			e.StoreWord(RBX, offI, hostI);
+		}
+	};
+
+	auto addPending = [&](uint32_t count) {
+		if (count > synced) {
+			e.AddMem(R15, pendingAt, int32_t(count - synced));
+		}
+	};
+
+	std::vector<std::pair<uint8_t*, uint16_t>> exits; //chained exits and their target pcs
+	std::vector<std::pair<uint8_t*, uint32_t>> stops; //helper bail outs and the instructions run before them
+	std::vector<uint8_t*> returns; //jumps to the shared ret
+
+	auto exitTo = [&](uint16_t target) {
+		writeBack();
+		e.StoreWordImm(RBX, offPc, target);
+		addPending(n);
+		exits.push_back(std::make_pair(e.Jump(), target));
+	};
+
+	auto exitDynamic = [&]() { //pc has already been stored
+		writeBack();
+		addPending(n);
+		returns.push_back(e.Jump());
+	};
+
+	auto callHelper = [&](uint32_t i, Instruction const& in, uint16_t next) {
+		writeBack();
+		e.StoreWordImm(RBX, offPc, next); //the interpreter increments the pc before executing
+		addPending(i);
+		synced = i;
+		block->helpers.push_back(in);
+		e.Mov64(RDI, RBX);
+		e.Mov64(RSI, R15);
+		e.MovImm64(RDX, reinterpret_cast<uint64_t>(&block->helpers.back()));
+		e.MovImm64(RAX, reinterpret_cast<uint64_t>(&Jit::Helper));
+		e.CallReg(RAX);
+	};
+
+	// entry: claim the budget for the whole block or bail out, then load the cached registers
+	e.SubMem(R15, budgetAt, int32_t(n));
+	uint8_t* bail = e.JumpIf(CC_L);
+	load();
+
+	bool terminated = false;
+	for (uint32_t i = 0; i < n; i++) {
+		Instruction const& in = code[i];
+		uint16_t next = uint16_t(start + 2 * (i + 1));
+		int x = host[in.x], y = host[in.y], f = host[0xF];
+
+		switch (kinds[i]) {
+			case K_INLINE:
+				switch (in.opcode >> 12u) {
+					case 0x6: e.MovImm(x, in.kk); break;
+					case 0x7: e.AddImm(x, in.kk); e.AndImm(x, 0xFF); break;
+					case 0xA: e.MovImm(hostI, in.nnn); break;
+					case 0xF: e.Add(hostI, x); e.AndImm(hostI, 0xFFFF); break; //Fx1E
+					case 0x8:
+						switch (in.n) {
+							case 0x0: e.Mov(x, y); break;
+							case 0x1: e.Or(x, y); break;
+							case 0x2: e.And(x, y); break;
+							case 0x3: e.Xor(x, y); break;
+							case 0x4: //VF = carry, then Vx = sum (same order as OP_8xy4)
+								e.Mov(RAX, x); e.Add(RAX, y);
+								e.Mov(RCX, RAX); e.Shr(RCX, 8);
+								e.AndImm(RAX, 0xFF);
+								e.Mov(f, RCX); e.Mov(x, RAX);
+								break;
+							case 0x5: //VF = Vx > Vy, then Vx -= Vy
+								e.Cmp(x, y); e.SetFlag(CC_A); e.Mov(f, RAX);
+								e.Mov(RAX, x); e.Sub(RAX, y); e.AndImm(RAX, 0xFF); e.Mov(x, RAX);
+								break;
+							case 0x6: //VF = LSB, then Vx >>= 1
+								e.Mov(RAX, x); e.AndImm(RAX, 0x1); e.Mov(f, RAX);
+								e.Shr(x, 1);
+								break;
+							case 0x7: //VF = Vy > Vx, then Vx = Vy - Vx
+								e.Cmp(y, x); e.SetFlag(CC_A); e.Mov(f, RAX);
+								e.Mov(RAX, y); e.Sub(RAX, x); e.AndImm(RAX, 0xFF); e.Mov(x, RAX);
+								break;
+							case 0xE: //VF = MSB, then Vx <<= 1
+								e.Mov(RAX, x); e.Shr(RAX, 7); e.Mov(f, RAX);
+								e.Shl(x, 1); e.AndImm(x, 0xFF);
+								break;
+						}
+						break;
+				}
+				break;
+
+			case K_HELPER:
+				callHelper(i, in, next);
+				e.TestEax();
+				stops.push_back(std::make_pair(e.JumpIf(CC_NE), i + 1));
+				load(); //the method may have changed any register
+				break;
+
+			case K_HELPER_END:
+				callHelper(i, in, next);
+				addPending(n); //memory is already up to date, the method set the pc
+				returns.push_back(e.Jump());
+				terminated = true;
+				break;
+
+			case K_SKIP: {
+				switch (in.opcode >> 12u) {
+					case 0x3: case 0x4: e.CmpImm(x, in.kk); break;
+					default: e.Cmp(x, y); break;
+				}
+				bool equal = (in.opcode >> 12u) == 0x3 || (in.opcode >> 12u) == 0x5;
+				uint8_t* taken = e.JumpIf(equal ? CC_E : CC_NE);
+				exitTo(next);
+				Emitter::Patch(taken, e.p);
+				exitTo(uint16_t(next + 2));
+				terminated = true;
+				break;
+			}
+
+			case K_JUMP:
+				exitTo(in.nnn);
+				terminated = true;
+				break;
+
+			case K_CALL:
+				e.LoadByte(RAX, RBX, offSp);
+				e.StoreStackImm(offStack, next);
+				e.IncByte(RBX, offSp);
+				exitTo(in.nnn);
+				terminated = true;
+				break;
+
+			case K_RETURN:
+				e.DecByte(RBX, offSp);
+				e.LoadByte(RAX, RBX, offSp);
+				e.LoadStack(offStack);
+				e.StoreWord(RBX, offPc, RAX);
+				exitDynamic();
+				terminated = true;
+				break;
+
+			case K_JUMP_V0:
+				e.Mov(RAX, host[0]);
+				e.AddImm(RAX, in.nnn);
+				e.StoreWord(RBX, offPc, RAX);
+				exitDynamic();
+				terminated = true;
+				break;
+		}
+	}
+
+	if (!terminated) {
+		exitTo(uint16_t(start + 2 * n)); //block was cut short, fall through into the next one
+	}
+
+	// bail out: not enough budget left for the whole block (the pc already points at the block)
+	Emitter::Patch(bail, e.p);
+	e.AddMem(R15, budgetAt, int32_t(n));
+	e.Ret();
+
+	// a helper invalidated compiled code: give back the unused budget and leave
+	for (auto const& stop : stops) {
+		Emitter::Patch(stop.first, e.p);
+		if (n > stop.second) {
+			e.AddMem(R15, budgetAt, int32_t(n - stop.second));
+		}
+		e.AddMem(R15, pendingAt, 1);
+		e.Ret();
+	}
+
+	uint8_t* ret = e.p;
+	e.Ret();
+	for (uint8_t* site : returns) {
+		Emitter::Patch(site, ret);
+	}
+
+	cursor = e.p;
+
+	// register the block, then chain it in both directions
+	all.push_back(std::move(owned));
+	blocks[start] = block;
+	for (unsigned int page = start >> PAGE_SHIFT; page <= unsigned(block->end - 1) >> PAGE_SHIFT; page++) {
+		pages[page].push_back(block);
+	}
+
+	for (auto const& exit : exits) {
+		Exit link = { exit.first, ret, block };
+		Link(link, exit.second);
+	}
+
+	std::vector<Exit> parked;
+	parked.swap(waiting[start]);
+	for (auto const& exit : parked) {
+		if (exit.owner->valid) {
+			Emitter::Patch(exit.site, block->entry);
+			block->incoming.push_back(exit);
+		}
+	}
+
+	return block;
+}
+
+void Jit::Link(Exit const& exit, uint16_t target) {
+	Block* block = target < MEMSIZE ? blocks[target] : nullptr;
+
+	if (block) {
+		Emitter::Patch(exit.site, block->entry);
+		block->incoming.push_back(exit);
+	}
+	else {
+		Emitter::Patch(exit.site, exit.fallback);
+		if (target < MEMSIZE) {
+			waiting[target].push_back(exit);
+		}
+	}
+}
+
+void Jit::Invalidate(Block* block) {
+	block->valid = false;
+	if (blocks[block->start] == block) {
+		blocks[block->start] = nullptr;
+	}
+	hits[block->start] = 0;
+
+	// anything chained into the block goes back to returning to Run(), and is re-chained if the block is recompiled
+	for (auto const& exit : block->incoming) {
+		Emitter::Patch(exit.site, exit.fallback);
+		if (exit.owner->valid) {
+			waiting[block->start].push_back(exit);
+		}
+	}
+	block->incoming.clear();
+
+	context.codeChanged = 1;
+}
+
+void Jit::CodeWritten(uint16_t address, uint16_t length) {
+	if (length == 0 || address >= MEMSIZE) {
+		return;
+	}
+
+	unsigned int last = address + length > MEMSIZE ? MEMSIZE - 1 : address + length - 1u;
+
+	for (unsigned int page = address >> PAGE_SHIFT; page <= last >> PAGE_SHIFT; page++) {
+		std::vector<Block*>& list = pages[page];
+
+		for (size_t i = 0; i < list.size();) {
+			Block* block = list[i];
+			bool overlaps = block->start <= last && address < block->end;
+
+			if (block->valid && overlaps) {
+				Invalidate(block);
+			}
+
+			if (!block->valid) {
+				list[i] = list.back();
+				list.pop_back();
+			}
+			else {
+				i++;
+			}
+		}
+	}
+}
+
+void Jit::Flush() {
+	for (auto& block : all) {
+		block->valid = false;
+	}
+	all.clear();
+
+	for (unsigned int a = 0; a < MEMSIZE; a++) {
+		blocks[a] = nullptr;
+		waiting[a].clear();
+	}
+	for (auto& page : pages) {
+		page.clear();
+	}
+
+	cursor = blockCode;
+}
+
+/* Called from compiled code with the pc already pointing past the instruction, like Chip8::Cycle() leaves it */
+uint32_t Jit::Helper(Chip8* chip, Context* context, Instruction const* in) {
+	chip->Tick(context->pending);
+	context->pending = 0;
+	context->codeChanged = 0;
+
+	chip->opcode = in->opcode;
+	chip->DispatchTable(*in);
+
+	return context->codeChanged;
+}
+
+#endif
@@ -0,0 +1,89 @@
+//
+// Basic block compiler that turns hot CHIP-8 code into x86-64 machine code.
+//
+
+#include "Chip8.h"
+#include <memory>
+#include <vector>
+
+#ifndef JIT_H
+#define JIT_H
+
+/*
+    Tiered execution for one Chip8:
+        - Code starts in the interpreter (Chip8::Cycle()). Every address that starts a basic block counts its executions.
+        - Once a block has run JIT_THRESHOLD times it is compiled. A block ends at 1nnn, 2nnn, 00EE, Bnnn, a skip
+          instruction or Fx0A.
+        - Inside a block the V registers and I live in host registers and the pc is a constant. Register arithmetic is
+          emitted inline; everything else (drawing, timers, keys, memory) calls the instruction method of the Chip8.
+        - Exits with a known target jump straight into the target block once it has been compiled (block chaining).
+        - Writes through Fx55/Fx33 invalidate the blocks on the written pages (Chip8::CodeWritten()).
+*/
+class Jit {
+private:
+    static const unsigned int JIT_THRESHOLD = 32; //block executions before it is compiled
+    static const unsigned int MAX_BLOCK = 64; //instructions per block
+    static const unsigned int PAGE_SHIFT = 8; //256 byte invalidation pages
+    static const size_t ARENA_SIZE = 4 << 20; //bytes of executable memory
+    static const size_t MAX_BLOCK_BYTES = 32 << 10; //worst case size of one compiled block
+
+    //data shared between the compiled code and the C++ side (addressed through r15)
+    struct Context {
+        int32_t budget; //instructions the compiled code may still run
+        uint32_t pending; //instructions run since the timers were last advanced
+        uint32_t codeChanged; //set when a helper invalidated compiled code
+    };
+
+    struct Block;
+
+    //a jump out of a block towards a fixed pc
+    struct Exit {
+        uint8_t* site; //rel32 operand of the jump
+        uint8_t* fallback; //where the jump goes while the target is not compiled
+        Block* owner; //block containing the jump
+    };
+
+    struct Block {
+        uint16_t start; //first address covered
+        uint16_t end; //one past the last address covered
+        uint8_t* entry; //machine code
+        bool valid;
+        std::vector<Instruction> helpers; //operands of the instructions executed through Chip8 methods
+        std::vector<Exit> incoming; //chained jumps into this block
+    };
+
+    Chip8& chip;
+    Context context = {};
+
+    uint8_t* arena = {}; //executable memory
+    uint8_t* blockCode = {}; //first byte after the trampoline
+    uint8_t* cursor = {}; //next free byte in the arena
+    void (*enter)(Chip8*, Context*, uint8_t*) = {}; //trampoline from C++ into a block
+
+    std::vector<std::unique_ptr<Block>> all; //every block compiled since the last flush
+    Block* blocks[MEMSIZE] = {}; //valid block starting at each address
+    std::vector<Block*> pages[MEMSIZE >> PAGE_SHIFT]; //blocks overlapping each page
+    std::vector<Exit> waiting[MEMSIZE]; //unchained exits waiting for a block at each address
+    uint16_t hits[MEMSIZE] = {}; //interpreted executions of each block start
+
+    //offsets of the Chip8 registers from the Chip8 pointer held in rbx
+    int32_t offV, offI, offPc, offSp, offStack;
+
+    Block* Compile(uint16_t); //compiles the block starting at an address
+    void Link(Exit const&, uint16_t); //points an exit at the block for a pc, or parks it until one exists
+    void Invalidate(Block*); //unlinks a block so it is never entered again
+    void Flush(); //drops all compiled code
+    static uint32_t Helper(Chip8*, Context*, Instruction const*); //runs one instruction through Chip8 for a block
+
+public:
+    explicit Jit(Chip8&);
+    ~Jit();
+    Jit(Jit const&) = delete;
+    Jit& operator=(Jit const&) = delete;
+
+    bool Ok() const { return arena != nullptr; } //false when no executable memory could be mapped (the machine runs without the JIT)
+    uint32_t Run(uint32_t); //executes up to the given number of instructions (less on Fx0A or an invalid opcode), returns how many ran
+    void CodeWritten(uint16_t, uint16_t); //invalidates blocks that overlap the written bytes
+};
+
+#endif
@@ -0,0 +1,598 @@
+//
+// Lockstep engine (see Lockstep.h)
+//
+
+#include "Lockstep.h"
+#include "Log.h"
+#include "Video.h"
+#include <algorithm>
+#include <memory>
+
+#define LOCKSTEP_INLINE inline __attribute__((always_inline))
+
+/* One element per lane: Bytes hold a register of every lane, Words hold I or the pc of every lane */
+template<unsigned int LANES>
+struct Vectors {
+	typedef uint8_t Bytes __attribute__((vector_size(LANES)));
+	typedef int8_t ByteMask __attribute__((vector_size(LANES))); //all ones in the lanes where a comparison holds
+	typedef uint16_t Words __attribute__((vector_size(2 * LANES)));
+	typedef int16_t WordMask __attribute__((vector_size(2 * LANES)));
+	typedef uint32_t Counts __attribute__((vector_size(4 * LANES))); //instructions left in the frame of every lane
+	typedef int32_t CountMask __attribute__((vector_size(4 * LANES)));
+};
+
+// vectors are only passed to and returned by always inlined helpers, so the warning that their calling convention
+// depends on AVX doesn't apply to them
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+/* Vectors are loaded from and stored to the per-lane arrays, which need no more alignment than their elements */
+template<typename Vector>
+static LOCKSTEP_INLINE Vector Load(void const* from) {
+	Vector v;
+	memcpy(&v, from, sizeof(v));
+	return v;
+}
+
+template<typename Vector>
+static LOCKSTEP_INLINE void Store(void* to, Vector const& v) {
+	memcpy(to, &v, sizeof(v));
+}
+
+/* "value" in the lanes of the mask, "old" in the others */
+template<typename Vector, typename Mask>
+static LOCKSTEP_INLINE Vector Select(Mask const& mask, Vector const& value, Vector const& old) {
+	return (value & Vector(mask)) | (old & ~Vector(mask));
+}
+
+#pragma GCC diagnostic pop
+
+/* Bit per lane where the mask is set */
+template<unsigned int LANES>
+static LOCKSTEP_INLINE uint32_t Bits(typename Vectors<LANES>::ByteMask const& mask) {
+	uint32_t bits = 0;
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		bits |= uint32_t(mask[l] & 1) << l;
+	}
+	return bits;
+}
+
+template<unsigned int LANES>
+Lockstep<LANES>::Lockstep() {
+	auto seed = std::chrono::system_clock::now().time_since_epoch().count();
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		pc[l] = START_ADD;
+		random[l] = Chip8::RandomSeed(seed + l); //as Chip8, every lane gets its own clock seed until Seed() is called
+	}
+}
+
+/* Loads the ROM once through Chip8 (same checks and font) and copies the memory into every lane */
+template<unsigned int LANES>
+bool Lockstep<LANES>::loadROM(char const* romfile) {
+	std::unique_ptr<Chip8> image(new Chip8());
+	if (!image->loadROM(romfile)) {
+		return false;
+	}
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		memcpy(memory[l], image->memory, MEMSIZE);
+	}
+	std::fill(std::begin(written), std::end(written), false);
+	return true;
+}
+
+template<unsigned int LANES>
+void Lockstep<LANES>::Seed(unsigned int lane, uint32_t seed) {
+	random[lane] = Chip8::RandomSeed(seed);
+}
+
+template<unsigned int LANES>
+void Lockstep<LANES>::SetSpeed(uint32_t ips) {
+	instructionsPerSecond = ips ? ips : 1;
+}
+
+template<unsigned int LANES>
+void Lockstep<LANES>::SetSpriteWrap(bool wrap) {
+	wrapSprites = wrap;
+}
+
+/* Chip8::Ticks() of a lane in the current frame (the speed never changes while running) */
+template<unsigned int LANES>
+uint64_t Lockstep<LANES>::Ticks(unsigned int lane) const {
+	return (frameEnd[lane] - left[lane]) * 60u / instructionsPerSecond;
+}
+
+template<unsigned int LANES>
+uint8_t Lockstep<LANES>::DelayTimer(unsigned int lane) const {
+	uint64_t elapsed = Ticks(lane) - delaySetAt[lane];
+	return elapsed >= delayTimer[lane] ? 0 : uint8_t(delayTimer[lane] - elapsed);
+}
+
+/*
+	Every lane gets the budget Chip8::RunFrame() would give it. A lane in an Fx0A wait either takes a key pressed now
+	or idles through the frame, which is what a host calling Chip8::RunFrame() until FrameComplete sees.
+*/
+template<unsigned int LANES>
+RunResult Lockstep<LANES>::RunFrame() {
+	LaneMask before = stopped;
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		frameEnd[l] = cycles[l];
+		left[l] = 0;
+		if (stopped >> l & 1u) {
+			continue;
+		}
+
+		frameEnd[l] = ((cycles[l] * 60u / instructionsPerSecond + 1) * instructionsPerSecond + 59u) / 60u; //first count at the next tick
+		left[l] = uint32_t(frameEnd[l] - cycles[l]);
+
+		if (waiting >> l & 1u) {
+			uint16_t keys = Chip8::KeyMask(keypad[l]);
+			if (keys) {
+				V[waitRegister[l]][l] = uint8_t(__builtin_ctz(keys));
+				waiting &= ~(1u << l);
+			}
+			else {
+				left[l] = 0;
+			}
+		}
+	}
+	Park((1u << (LANES - 1) << 1) - 1);
+
+	// the lane furthest behind leads, lanes parked on the pcs it runs through join it
+	while (parked) {
+		unsigned int lead = __builtin_ctz(parked);
+		for (LaneMask p = parked; p; p &= p - 1) {
+			unsigned int l = __builtin_ctz(p);
+			if (left[l] > left[lead]) {
+				lead = l;
+			}
+		}
+		RunBlock(lead);
+	}
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		cycles[l] = frameEnd[l] - left[l];
+	}
+
+	return stopped != before ? RunResult::InvalidOpcode : RunResult::FrameComplete;
+}
+
+/*
+	Chip8::FastForward() for the lanes of a group sitting on a delay timer poll loop. Every lane skips the whole
+	iterations it can't leave the loop in, and keeps running it from where that leaves it. Returns the lanes whose frame
+	is done.
+*/
+template<unsigned int LANES>
+typename Lockstep<LANES>::LaneMask Lockstep<LANES>::FastForward(LaneMask group, uint16_t address) {
+	const uint32_t length = 3;
+	LaneMask done = 0;
+
+	for (; group; group &= group - 1) {
+		unsigned int l = __builtin_ctz(group);
+		uint8_t kk = memory[l][address + 3];
+		uint8_t timer = DelayTimer(l);
+		uint64_t iterations = left[l] / length;
+
+		if (timer == kk) { //leaves the loop this iteration
+			continue;
+		}
+		if (timer > kk) { //otherwise the loop spins until the end of the frame
+			uint64_t tick = delaySetAt[l] + delayTimer[l] - kk;
+			uint64_t cycle = (tick * instructionsPerSecond + 59u) / 60u;
+			iterations = std::min<uint64_t>(iterations, (cycle - (frameEnd[l] - left[l]) + length - 1) / length);
+		}
+
+		uint32_t skip = uint32_t(iterations * length);
+		if (skip) { //Fx07 of the last skipped iteration leaves its reading in Vx
+			left[l] -= skip - length;
+			V[memory[l][address] & 0x0Fu][l] = DelayTimer(l);
+			left[l] -= length;
+		}
+		done |= LaneMask(left[l] == 0) << l;
+	}
+
+	return done;
+}
+
+/* Lanes that still have instructions to run this frame wait on their pc for a group to come past */
+template<unsigned int LANES>
+void Lockstep<LANES>::Park(LaneMask lanes) {
+	lanes &= ~(waiting | stopped);
+
+	for (; lanes; lanes &= lanes - 1) {
+		unsigned int l = __builtin_ctz(lanes);
+
+		if (left[l]) {
+			parked |= 1u << l;
+			++parkedAt[pc[l] & (MEMSIZE - 1)];
+		}
+	}
+}
+
+// the helpers above are instantiated by RunGroup(), and GCC checks those instantiations once it reaches the end of the
+// file, so the warning stays off from here to the end
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+/*
+	Runs a group an instruction at a time, starting with the lanes parked on the pc of the lead. Every lane of the
+	group sits on the same pc, and lanes parked on the pc the group gets to join it. A lane leaves the group when its
+	opcode there differs (only possible where some lane wrote memory), when its pc differs from the group's after the
+	instruction, when its frame is done, or when it starts an Fx0A wait or hits an invalid opcode. Lanes that leave with
+	instructions left are parked again.
+*/
+template<unsigned int LANES>
+void Lockstep<LANES>::RunGroup(unsigned int first) {
+	typedef typename Vectors<LANES>::Bytes Bytes;
+	typedef typename Vectors<LANES>::ByteMask ByteMask;
+	typedef typename Vectors<LANES>::Words Words;
+	typedef typename Vectors<LANES>::WordMask WordMask;
+	typedef typename Vectors<LANES>::Counts Counts;
+	typedef typename Vectors<LANES>::CountMask CountMask;
+
+	ByteMask maskB = {}; //all ones in the lanes of the group
+	WordMask maskW = {};
+	CountMask maskC = {};
+	LaneMask group = 0;
+	LaneMask masked = 0; //group the masks were built for
+	uint32_t budget = UINT32_MAX; //instructions until the first lane of the group is done with its frame
+	uint16_t at = pc[first]; //pc of the group
+
+	// Vx of the group lanes, the other lanes keep theirs
+	auto setV = [&](unsigned int x, Bytes const& value) __attribute__((always_inline)) {
+		Store(V[x], Select(maskB, value, Load<Bytes>(V[x])));
+	};
+
+	for (;;) {
+		uint16_t address = at & (MEMSIZE - 1);
+		uint16_t next = (address + 1) & (MEMSIZE - 1);
+
+		if (parkedAt[address]) {
+			for (LaneMask p = parked; p; p &= p - 1) {
+				unsigned int l = __builtin_ctz(p);
+				if (pc[l] == at) {
+					parked &= ~(1u << l);
+					--parkedAt[address];
+					group |= 1u << l;
+					budget = std::min(budget, left[l]);
+				}
+			}
+		}
+		if (!group) {
+			break;
+		}
+
+		unsigned int lead = __builtin_ctz(group);
+		uint16_t opcode = uint16_t((memory[lead][address] << 8u) | memory[lead][next]);
+
+		if (written[address] || written[next]) {
+			LaneMask same = 0;
+			for (LaneMask g = group; g; g &= g - 1) {
+				unsigned int l = __builtin_ctz(g);
+				same |= LaneMask(((memory[l][address] << 8u) | memory[l][next]) == opcode) << l;
+			}
+			if (group & ~same) {
+				LaneMask other = group & ~same;
+				group &= same;
+				Park(other);
+			}
+		}
+
+		// delay timer poll loop (see Chip8::IdleLoop()): skip the iterations that can't leave it, as Chip8 does
+		bool poll = (opcode & 0xF0FFu) == 0xF007u && address + 5u < MEMSIZE &&
+			unsigned(memory[lead][address + 2]) == (0x30u | (opcode >> 8u & 0x0Fu)) &&
+			unsigned((memory[lead][address + 4] << 8u) | memory[lead][address + 5]) == (0x1000u | address) &&
+			std::find(written + address, written + address + 6, true) == written + address + 6; //the same loop in every lane
+		if (poll) {
+			LaneMask done = FastForward(group, address);
+			if (done) {
+				group &= ~done;
+				if (!group) {
+					break;
+				}
+				lead = __builtin_ctz(group);
+			}
+			budget = UINT32_MAX;
+			for (LaneMask g = group; g; g &= g - 1) {
+				budget = std::min(budget, left[__builtin_ctz(g)]);
+			}
+		}
+
+		if (group != masked) {
+			for (unsigned int l = 0; l < LANES; l++) {
+				maskB[l] = (group >> l & 1u) ? -1 : 0;
+				maskW[l] = (group >> l & 1u) ? -1 : 0;
+				maskC[l] = (group >> l & 1u) ? -1 : 0;
+			}
+			masked = group;
+		}
+
+		Instruction const in = Chip8::Decode(opcode);
+		LaneMask leave = 0; //lanes that drop out of the group after this instruction
+		ByteMask skip = {}; //lanes that skip the next instruction
+		bool skips = false;
+		bool branches = false; //pcs may differ after the instruction
+
+		Store(pc, Load<Words>(pc) + (Words(maskW) & 2));
+
+		switch (Chip8::Identify(opcode)) {
+			case Chip8::ID_00E0:
+				for (LaneMask g = group; g; g &= g - 1) {
+					videoKernels->clear(video[__builtin_ctz(g)]);
+				}
+				break;
+
+			case Chip8::ID_00EE:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					--sp[l];
+					pc[l] = stack[l][sp[l] & 0xFu];
+				}
+				branches = true;
+				break;
+
+			case Chip8::ID_1nnn:
+				Store(pc, Select(maskW, Words{} + in.nnn, Load<Words>(pc)));
+				if (in.nnn == at) { //jump to itself: nothing but time passes until the end of the frame
+					for (LaneMask g = group; g; g &= g - 1) {
+						left[__builtin_ctz(g)] = 1; //the jump itself
+					}
+					leave = group;
+				}
+				break;
+
+			case Chip8::ID_2nnn:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					stack[l][sp[l] & 0xFu] = pc[l];
+					++sp[l];
+				}
+				Store(pc, Select(maskW, Words{} + in.nnn, Load<Words>(pc)));
+				break;
+
+			case Chip8::ID_3xkk: skip = Load<Bytes>(V[in.x]) == in.kk; skips = true; break;
+			case Chip8::ID_4xkk: skip = Load<Bytes>(V[in.x]) != in.kk; skips = true; break;
+			case Chip8::ID_5xy0: skip = Load<Bytes>(V[in.x]) == Load<Bytes>(V[in.y]); skips = true; break;
+			case Chip8::ID_9xy0: skip = Load<Bytes>(V[in.x]) != Load<Bytes>(V[in.y]); skips = true; break;
+
+			case Chip8::ID_6xkk: setV(in.x, Bytes{} + in.kk); break;
+			case Chip8::ID_7xkk: setV(in.x, Load<Bytes>(V[in.x]) + in.kk); break;
+			case Chip8::ID_8xy0: setV(in.x, Load<Bytes>(V[in.y])); break;
+			case Chip8::ID_8xy1: setV(in.x, Load<Bytes>(V[in.x]) | Load<Bytes>(V[in.y])); break;
+			case Chip8::ID_8xy2: setV(in.x, Load<Bytes>(V[in.x]) & Load<Bytes>(V[in.y])); break;
+			case Chip8::ID_8xy3: setV(in.x, Load<Bytes>(V[in.x]) ^ Load<Bytes>(V[in.y])); break;
+
+			// VF is written first and the result read after it, in the order of the Chip8 methods (x or y may be F)
+			case Chip8::ID_8xy4: {
+				Bytes x = Load<Bytes>(V[in.x]);
+				Bytes sum = x + Load<Bytes>(V[in.y]);
+				setV(0xF, Bytes(sum < x) & 1);
+				setV(in.x, sum);
+				break;
+			}
+
+			case Chip8::ID_8xy5:
+				setV(0xF, Bytes(Load<Bytes>(V[in.x]) > Load<Bytes>(V[in.y])) & 1);
+				setV(in.x, Load<Bytes>(V[in.x]) - Load<Bytes>(V[in.y]));
+				break;
+
+			case Chip8::ID_8xy6:
+				setV(0xF, Load<Bytes>(V[in.x]) & 1);
+				setV(in.x, Load<Bytes>(V[in.x]) >> 1);
+				break;
+
+			case Chip8::ID_8xy7:
+				setV(0xF, Bytes(Load<Bytes>(V[in.y]) > Load<Bytes>(V[in.x])) & 1);
+				setV(in.x, Load<Bytes>(V[in.y]) - Load<Bytes>(V[in.x]));
+				break;
+
+			case Chip8::ID_8xyE:
+				setV(0xF, Load<Bytes>(V[in.x]) >> 7);
+				setV(in.x, Load<Bytes>(V[in.x]) << 1);
+				break;
+
+			case Chip8::ID_Annn:
+				Store(I, Select(maskW, Words{} + in.nnn, Load<Words>(I)));
+				break;
+
+			case Chip8::ID_Bnnn:
+				Store(pc, Select(maskW, __builtin_convertvector(Load<Bytes>(V[0]), Words) + in.nnn, Load<Words>(pc)));
+				branches = true;
+				break;
+
+			case Chip8::ID_Cxkk:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					V[in.x][l] = Chip8::RandomByte(random[l]) & in.kk;
+				}
+				break;
+
+			case Chip8::ID_Dxyn:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					uint8_t xPos = V[in.x][l] % VIDEO_WIDTH;
+					uint8_t yPos = V[in.y][l] % VIDEO_HEIGHT;
+					unsigned int rows = wrapSprites ? in.n : std::min<unsigned int>(in.n, VIDEO_HEIGHT - yPos);
+					unsigned int above = std::min<unsigned int>(rows, VIDEO_HEIGHT - yPos);
+					uint8_t sprite[16];
+
+					for (unsigned int row = 0; row < rows; row++) {
+						sprite[row] = memory[l][(I[l] + row) & (MEMSIZE - 1)];
+					}
+
+					uint64_t collided = videoKernels->blit(video[l] + yPos, sprite, above, xPos, wrapSprites);
+					if (rows > above) { //wrapped past the bottom
+						collided |= videoKernels->blit(video[l], sprite + above, rows - above, xPos, wrapSprites);
+					}
+					V[0xF][l] = collided != 0;
+				}
+				break;
+
+			case Chip8::ID_Ex9E:
+			case Chip8::ID_ExA1: {
+				bool pressed = in.kk == 0x9E;
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					if ((keypad[l][V[in.x][l] & 0xFu] != 0) == pressed) {
+						pc[l] += 2;
+					}
+				}
+				branches = true;
+				break;
+			}
+
+			case Chip8::ID_Fx07:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					V[in.x][l] = DelayTimer(l);
+				}
+				break;
+
+			case Chip8::ID_Fx0A:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					uint16_t keys = Chip8::KeyMask(keypad[l]);
+
+					if (keys) {
+						V[in.x][l] = uint8_t(__builtin_ctz(keys));
+					}
+					else {
+						waiting |= 1u << l;
+						waitRegister[l] = in.x;
+						leave |= 1u << l;
+					}
+				}
+				break;
+
+			case Chip8::ID_Fx15:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					delayTimer[l] = V[in.x][l];
+					delaySetAt[l] = Ticks(l);
+				}
+				break;
+
+			case Chip8::ID_Fx18:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					soundTimer[l] = V[in.x][l];
+					soundSetAt[l] = Ticks(l);
+				}
+				break;
+
+			case Chip8::ID_Fx1E:
+				Store(I, Select(maskW, Load<Words>(I) + __builtin_convertvector(Load<Bytes>(V[in.x]), Words), Load<Words>(I)));
+				break;
+
+			case Chip8::ID_Fx29:
+				Store(I, Select(maskW, FONTSET_START_ADD + 5 * __builtin_convertvector(Load<Bytes>(V[in.x]), Words), Load<Words>(I)));
+				break;
+
+			case Chip8::ID_Fx33:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+					uint8_t value = V[in.x][l];
+
+					for (int digit = 2; digit >= 0; digit--) {
+						unsigned int at = (I[l] + digit) & (MEMSIZE - 1);
+						memory[l][at] = value % 10;
+						written[at] = true;
+						value /= 10;
+					}
+				}
+				break;
+
+			case Chip8::ID_Fx55:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+
+					for (unsigned int i = 0; i <= in.x; i++) {
+						unsigned int at = (I[l] + i) & (MEMSIZE - 1);
+						memory[l][at] = V[i][l];
+						written[at] = true;
+					}
+				}
+				break;
+
+			case Chip8::ID_Fx65:
+				for (LaneMask g = group; g; g &= g - 1) {
+					unsigned int l = __builtin_ctz(g);
+
+					for (unsigned int i = 0; i <= in.x; i++) {
+						V[i][l] = memory[l][(I[l] + i) & (MEMSIZE - 1)];
+					}
+				}
+				break;
+
+			default: //invalid opcode: the lanes stay on it and stop for good
+				LOG_ERROR("Invalid opcode " << std::hex << opcode << " in lanes " << group);
+				Store(pc, Load<Words>(pc) - (Words(maskW) & 2));
+				stopped |= group;
+				leave = group;
+				break;
+		}
+
+		if (skips) {
+			skip &= maskB;
+			Store(pc, Load<Words>(pc) + (Words(__builtin_convertvector(skip, WordMask)) & 2));
+			LaneMask taken = Bits<LANES>(skip);
+			leave |= (taken >> lead & 1u) ? group & ~taken : taken; //the lanes that went the other way from the lead
+		}
+		else if (branches) {
+			for (LaneMask g = group; g; g &= g - 1) {
+				unsigned int l = __builtin_ctz(g);
+				leave |= LaneMask(pc[l] != pc[lead]) << l;
+			}
+		}
+
+		Store(left, Load<Counts>(left) + Counts(maskC)); //one instruction less for every lane of the group
+		++steps;
+		laneSteps += __builtin_popcount(group);
+
+		if (--budget == 0) { //some lanes are done with the frame
+			budget = UINT32_MAX;
+			for (LaneMask g = group; g; g &= g - 1) {
+				unsigned int l = __builtin_ctz(g);
+				leave |= LaneMask(left[l] == 0) << l;
+				budget = std::min(budget, left[l] ? left[l] : UINT32_MAX);
+			}
+		}
+		if (leave) {
+			for (LaneMask w = leave & waiting; w; w &= w - 1) { //the rest of the frame is idle
+				left[__builtin_ctz(w)] = 0;
+			}
+			group &= ~leave;
+			Park(leave);
+			if (!group) {
+				break;
+			}
+		}
+		at = pc[__builtin_ctz(group)];
+	}
+}
+
+#if LOCKSTEP_AVX2
+template<unsigned int LANES>
+void Lockstep<LANES>::RunGroupAvx2(unsigned int first) {
+	RunGroup(first);
+}
+
+static const bool HAS_AVX2 = VideoKernelsSupported("avx2"); //same cpu check as the display kernels
+#endif
+
+template<unsigned int LANES>
+void Lockstep<LANES>::RunBlock(unsigned int first) {
+#if LOCKSTEP_AVX2
+	if (HAS_AVX2) {
+		RunGroupAvx2(first);
+		return;
+	}
+#endif
+	RunGroup(first);
+}
+
+template class Lockstep<8>;
+template class Lockstep<16>;
+template class Lockstep<32>;
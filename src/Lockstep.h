@@ -0,0 +1,104 @@
+//
+// Lockstep engine: many instances of one ROM run side by side, an instruction at a time across all of them (SIMD).
+//
+
+#include "Chip8.h"
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+// the group loop is compiled for AVX2 as well as for the baseline, and picked by the CPU it runs on (GCC/Clang on x86-64)
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LOCKSTEP_AVX2 1
+#else
+#define LOCKSTEP_AVX2 0
+#endif
+
+/*
+    Seed and input sweeps run the same program hundreds of times, and the instances mostly sit on the same instruction.
+    Lockstep keeps the state of 8, 16 or 32 instances ("lanes") as a structure of arrays: every register is an array
+    with one element per lane, so a register operation is one vector instruction for all of them (AVX2 when the CPU
+    has it, the run loop is built for both AVX2 and the baseline and picked at load time).
+
+    Lanes run in groups: the group is every lane at the pc of the lane furthest behind. Each instruction runs on the
+    whole group under a lane mask, and lanes whose pc no longer matches after a skip, Bnnn or 00EE are masked out.
+    They are regrouped when the block ends, which is when the group is empty or the lane that ran least is done.
+
+    Register, I and pc operations are vectorised. Instructions on per-lane memory, stack, keypad, display or random
+    generator (00E0, 00EE, 2nnn, Cxkk, Dxyn, Ex9E, ExA1, Fx07, Fx0A, Fx15, Fx18, Fx33, Fx55, Fx65) loop over the lanes
+    of the group. Results match Chip8 with the same seed, speed and keys exactly (Chip8.cpp is the reference), except
+    that no frame version or dirty rectangle is kept.
+*/
+template<unsigned int LANES>
+class Lockstep {
+private:
+    static_assert(LANES == 8 || LANES == 16 || LANES == 32, "Lockstep runs 8, 16 or 32 lanes");
+
+    typedef uint32_t LaneMask; //bit per lane
+
+    uint8_t V[16][LANES] = {}; //register Vx of every lane
+    uint16_t I[LANES] = {};
+    uint16_t pc[LANES] = {};
+    uint8_t sp[LANES] = {};
+    uint16_t stack[LANES][16] = {};
+    uint8_t memory[LANES][MEMSIZE] = {};
+
+    //timers as in Chip8: the value they were set to and the tick they were set on
+    uint8_t delayTimer[LANES] = {};
+    uint8_t soundTimer[LANES] = {};
+    uint64_t delaySetAt[LANES] = {};
+    uint64_t soundSetAt[LANES] = {};
+
+    uint64_t cycles[LANES] = {}; //instructions executed by each lane since power on
+    uint32_t instructionsPerSecond = 600;
+    bool wrapSprites = {};
+
+    LaneMask waiting = {}; //lanes in an Fx0A wait
+    LaneMask stopped = {}; //lanes that hit an invalid opcode (they don't run again)
+    uint8_t waitRegister[LANES] = {};
+
+    bool written[MEMSIZE] = {}; //some lane wrote the address since the ROM was loaded, so the lanes may disagree on it
+
+    uint64_t steps = {}; //instructions issued to a group
+    uint64_t laneSteps = {}; //instructions executed by a lane (steps times the lanes in the group)
+
+    uint32_t random[LANES] = {}; //random number generator of every lane (Chip8::RandomByte())
+
+    //state of the frame being run
+    uint64_t frameEnd[LANES] = {}; //instruction count each lane stops at
+    uint32_t left[LANES] = {}; //instructions each lane still has to run
+    LaneMask parked = {}; //lanes with instructions left that are not in the running group
+    uint8_t parkedAt[MEMSIZE] = {}; //parked lanes on each address
+
+    uint64_t Ticks(unsigned int) const; //Chip8::Ticks() of a lane
+    uint8_t DelayTimer(unsigned int) const;
+    void Park(LaneMask); //lanes wait on their pc for a group to join
+    LaneMask FastForward(LaneMask, uint16_t); //skips the busy-wait iterations of a delay timer poll loop
+    void RunBlock(unsigned int); //runs the lanes on the pc of a lane, and the lanes they meet, until none is left
+    inline __attribute__((always_inline)) void RunGroup(unsigned int); //body of RunBlock(), compiled once per instruction set
+#if LOCKSTEP_AVX2
+    __attribute__((target("avx2"))) void RunGroupAvx2(unsigned int);
+#endif
+
+public:
+    Lockstep();
+    bool loadROM(char const*); //the same program in every lane, false as Chip8::loadROM()
+    RunResult RunFrame(); //runs every lane to the end of its current frame, InvalidOpcode if a lane stopped in it
+    void Seed(unsigned int, uint32_t); //seeds the random number generator of one lane (as Chip8::Seed())
+    void SetSpeed(uint32_t); //instructions per second of every lane (set before running)
+    void SetSpriteWrap(bool);
+
+    uint64_t Cycles(unsigned int lane) const { return cycles[lane]; }
+    bool WaitingForKey(unsigned int lane) const { return waiting >> lane & 1u; }
+    bool Stopped(unsigned int lane) const { return stopped >> lane & 1u; } //hit an invalid opcode (the pc stays on it)
+    double Occupancy() const { return steps ? double(laneSteps) / steps : 0; } //average lanes per instruction issued
+
+    uint8_t keypad[LANES][16] = {}; //keypad of every lane
+    uint64_t video[LANES][VIDEO_HEIGHT] = {}; //display of every lane, packed as Chip8::video
+};
+
+extern template class Lockstep<8>;
+extern template class Lockstep<16>;
+extern template class Lockstep<32>;
+
+#endif
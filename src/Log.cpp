@@ -0,0 +1,100 @@
+//
+// Asynchronous log sink (see Log.h)
+//
+
+#include "Log.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/*
+    Lines are appended to a queue under a mutex and a single thread writes them out, so the emulator thread never
+    blocks on the terminal. The sink is created by the first message and drained when the program exits.
+*/
+class Sink {
+private:
+    std::mutex mutex;
+    std::condition_variable wake; //the writer has work (or has to stop)
+    std::condition_variable drained; //the writer caught up with "queued"
+    std::vector<std::string> pending;
+    uint64_t queued = 0; //lines handed to Push()
+    uint64_t written = 0; //lines already written to stderr
+    bool stopping = false;
+    std::thread writer; //started last, once everything above is initialized
+
+    void Drain() {
+        std::vector<std::string> batch;
+        std::string text;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) { //stopping with nothing left
+                return;
+            }
+
+            batch.swap(pending);
+            lock.unlock();
+
+            text.clear();
+            for (auto const& line : batch) {
+                text += line;
+                text += '\n';
+            }
+            std::fwrite(text.data(), 1, text.size(), stderr);
+            std::fflush(stderr);
+
+            lock.lock();
+            written += batch.size();
+            batch.clear();
+            drained.notify_all();
+        }
+    }
+
+public:
+    Sink() : writer(&Sink::Drain, this) {}
+
+    ~Sink() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+
+    void Push(std::string const& line) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(line);
+            ++queued;
+        }
+        wake.notify_one();
+    }
+
+    void Flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t target = queued;
+        drained.wait(lock, [this, target] { return written >= target; });
+    }
+};
+
+Sink& GetSink() {
+    static Sink sink; //destroyed (and drained) at exit, including exit() calls
+    return sink;
+}
+
+}
+
+void Log::Write(std::string const& line) {
+    GetSink().Push(line);
+}
+
+void Log::Flush() {
+    GetSink().Flush();
+}
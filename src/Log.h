@@ -0,0 +1,76 @@
+//
+// Logging with the level chosen at compile time. Messages below the level are compiled out, the rest are handed to a
+// background thread that writes them to stderr in batches.
+//
+#include <sstream>
+#include <string>
+
+#ifndef LOG_H
+#define LOG_H
+
+/*
+    Pick the lowest level that is built in with -DCHIP8_LOG_LEVEL=<value>:
+        CHIP8_LOG_LEVEL_TRACE --> every executed instruction (slow, debugging only)
+        CHIP8_LOG_LEVEL_DEBUG --> internal details of the engines
+        CHIP8_LOG_LEVEL_INFO --> construction, ROM loading, frontend lifetime (default)
+        CHIP8_LOG_LEVEL_WARN
+        CHIP8_LOG_LEVEL_ERROR --> invalid opcodes, files that can't be loaded
+        CHIP8_LOG_LEVEL_OFF --> nothing
+*/
+#define CHIP8_LOG_LEVEL_TRACE 0
+#define CHIP8_LOG_LEVEL_DEBUG 1
+#define CHIP8_LOG_LEVEL_INFO 2
+#define CHIP8_LOG_LEVEL_WARN 3
+#define CHIP8_LOG_LEVEL_ERROR 4
+#define CHIP8_LOG_LEVEL_OFF 5
+
+#ifndef CHIP8_LOG_LEVEL
+#define CHIP8_LOG_LEVEL CHIP8_LOG_LEVEL_INFO
+#endif
+
+class Log {
+public:
+    static void Write(std::string const&); //queues a line for the sink thread (the sink adds the newline)
+    static void Flush(); //blocks until everything queued so far has been written
+};
+
+//formats on the calling thread, so only enabled levels pay for it. "message" can chain <<, e.g. LOG_ERROR("bad " << x)
+#define CHIP8_LOG_WRITE(message) do { \
+        std::ostringstream logLine; \
+        logLine << message; \
+        Log::Write(logLine.str()); \
+    } while (0)
+
+#define CHIP8_LOG_NOTHING() do {} while (0)
+
+#if CHIP8_LOG_LEVEL <= CHIP8_LOG_LEVEL_TRACE
+#define LOG_TRACE(message) CHIP8_LOG_WRITE(message)
+#else
+#define LOG_TRACE(message) CHIP8_LOG_NOTHING()
+#endif
+
+#if CHIP8_LOG_LEVEL <= CHIP8_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(message) CHIP8_LOG_WRITE(message)
+#else
+#define LOG_DEBUG(message) CHIP8_LOG_NOTHING()
+#endif
+
+#if CHIP8_LOG_LEVEL <= CHIP8_LOG_LEVEL_INFO
+#define LOG_INFO(message) CHIP8_LOG_WRITE(message)
+#else
+#define LOG_INFO(message) CHIP8_LOG_NOTHING()
+#endif
+
+#if CHIP8_LOG_LEVEL <= CHIP8_LOG_LEVEL_WARN
+#define LOG_WARN(message) CHIP8_LOG_WRITE(message)
+#else
+#define LOG_WARN(message) CHIP8_LOG_NOTHING()
+#endif
+
+#if CHIP8_LOG_LEVEL <= CHIP8_LOG_LEVEL_ERROR
+#define LOG_ERROR(message) CHIP8_LOG_WRITE(message)
+#else
+#define LOG_ERROR(message) CHIP8_LOG_NOTHING()
+#endif
+
+#endif
@@ -0,0 +1,300 @@
+//
+// Movie recording and replay (see Movie.h)
+//
+
+#include "Movie.h"
+#include "Log.h"
+#include "Video.h"
+#include <algorithm>
+#include <cstdio>
+
+static const char MOVIE_MAGIC[4] = {'C', '8', 'M', 'V'};
+static const char MOVIE_END_MAGIC[4] = {'C', '8', 'M', 'X'};
+static const uint16_t MOVIE_VERSION = 1;
+static const size_t MOVIE_HEADER = 4 + 2 + 2 + 4 + 4 + 8 * 4;
+static const size_t MOVIE_FOOTER = 8 + 4 + 4;
+
+/* Appends a number in "size" little endian bytes */
+static void Put(std::vector<uint8_t>& out, uint64_t value, unsigned int size) {
+	for (unsigned int b = 0; b < size; b++) {
+		out.push_back(uint8_t(value >> (8 * b)));
+	}
+}
+
+/* Appends a number in LEB128 (7 bits a byte, high bit set on all but the last), small deltas take one byte */
+static void PutVarint(std::vector<uint8_t>& out, uint64_t value) {
+	while (value >= 0x80) {
+		out.push_back(uint8_t(value) | 0x80u);
+		value >>= 7u;
+	}
+	out.push_back(uint8_t(value));
+}
+
+/* Reads numbers back, "ok" drops to false (and stays there) on a read past the end */
+struct MovieCursor {
+	std::vector<uint8_t> const& bytes;
+	size_t at;
+	bool ok;
+
+	uint64_t Get(unsigned int size) {
+		uint64_t value = 0;
+		if (size > bytes.size() - std::min(at, bytes.size())) {
+			ok = false;
+			return 0;
+		}
+		for (unsigned int b = 0; b < size; b++) {
+			value |= uint64_t(bytes[at++]) << (8 * b);
+		}
+		return value;
+	}
+
+	uint64_t Varint() {
+		uint64_t value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7) {
+			uint64_t byte = Get(1);
+			value |= (byte & 0x7Fu) << shift;
+			if (!(byte & 0x80u)) {
+				return value;
+			}
+		}
+		ok = false;
+		return 0;
+	}
+};
+
+MovieRecorder::MovieRecorder(uint32_t s, uint32_t keyframeInterval) : seed(s), interval(std::max(keyframeInterval, 1u)) {
+}
+
+void MovieRecorder::Frame(Chip8 const& chip) {
+	uint16_t keys = 0;
+	for (unsigned int key = 0; key < 16; key++) {
+		keys |= uint16_t(chip.keypad[key] != 0) << key;
+	}
+
+	if (keys != (events.empty() ? 0 : events.back().keys)) {
+		events.push_back({frames, chip.Cycles(), keys});
+	}
+	if (frames % interval == 0) {
+		keyframes.push_back({frames, events.size(), chip.SaveStateBytes()});
+	}
+	++frames;
+}
+
+void MovieRecorder::StepBack() {
+	if (!frames) {
+		return;
+	}
+
+	--frames;
+	while (!events.empty() && events.back().frame >= frames) {
+		events.pop_back();
+	}
+	while (!keyframes.empty() && keyframes.back().frame >= frames) {
+		keyframes.pop_back();
+	}
+}
+
+bool MovieRecorder::Save(char const* filename, Chip8 const& chip) const {
+	std::vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+	Put(out, MOVIE_VERSION, 2);
+	Put(out, 0, 2); //reserved
+	Put(out, seed, 4);
+	Put(out, interval, 4);
+	Put(out, frames, 8);
+	Put(out, events.size(), 8);
+	Put(out, chip.Cycles(), 8);
+	Put(out, videoKernels->hash(chip.video), 8);
+
+	std::vector<uint64_t> eventOffsets; //where each event starts, and the end of the last one
+	MovieEvent previous = {};
+	for (MovieEvent const& event : events) {
+		eventOffsets.push_back(out.size());
+		PutVarint(out, event.frame - previous.frame);
+		PutVarint(out, event.cycle - previous.cycle);
+		Put(out, event.keys, 2);
+		previous = event;
+	}
+	eventOffsets.push_back(out.size());
+
+	std::vector<uint64_t> keyframeOffsets;
+	for (Keyframe const& keyframe : keyframes) {
+		MovieEvent base = keyframe.event ? events[keyframe.event - 1] : MovieEvent{}; //the deltas that follow start from it
+
+		keyframeOffsets.push_back(out.size());
+		Put(out, keyframe.frame, 8);
+		Put(out, keyframe.event, 8);
+		Put(out, eventOffsets[keyframe.event], 8);
+		Put(out, base.frame, 8);
+		Put(out, base.cycle, 8);
+		Put(out, keyframe.state.size(), 4);
+		out.insert(out.end(), keyframe.state.begin(), keyframe.state.end());
+	}
+
+	uint64_t indexOffset = out.size();
+	for (size_t k = 0; k < keyframes.size(); k++) {
+		Put(out, keyframes[k].frame, 8);
+		Put(out, keyframeOffsets[k], 8);
+	}
+	Put(out, indexOffset, 8);
+	Put(out, keyframes.size(), 4);
+	out.insert(out.end(), MOVIE_END_MAGIC, MOVIE_END_MAGIC + sizeof(MOVIE_END_MAGIC));
+
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		LOG_ERROR("Movie: could not open " << filename);
+		return false;
+	}
+
+	bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+	written = fclose(file) == 0 && written;
+	if (!written) {
+		LOG_ERROR("Movie: could not write " << filename);
+		return false;
+	}
+
+	LOG_INFO("Movie: " << frames << " frames, " << events.size() << " key changes and " << keyframes.size()
+		<< " keyframes written to " << filename << " (" << out.size() << " bytes)");
+	return true;
+}
+
+bool MoviePlayer::Open(char const* filename) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		LOG_ERROR("Movie: could not open " << filename);
+		return false;
+	}
+
+	fseek(file, 0L, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	bytes.resize(size > 0 ? size_t(size) : 0);
+	bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+	fclose(file);
+
+	if (bytes.size() < MOVIE_HEADER + MOVIE_FOOTER || memcmp(bytes.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0
+		|| memcmp(&bytes[bytes.size() - sizeof(MOVIE_END_MAGIC)], MOVIE_END_MAGIC, sizeof(MOVIE_END_MAGIC)) != 0) {
+		LOG_ERROR("Movie: " << filename << " is not a movie or was not finished");
+		return false;
+	}
+
+	MovieCursor header = {bytes, sizeof(MOVIE_MAGIC), true};
+	uint16_t version = uint16_t(header.Get(2));
+	if (version != MOVIE_VERSION) {
+		LOG_ERROR("Movie: " << filename << " is version " << version << ", this build reads version " << MOVIE_VERSION);
+		return false;
+	}
+	header.Get(2);
+	seed = uint32_t(header.Get(4));
+	header.Get(4); //keyframe interval (the index is what seeking uses)
+	frames = header.Get(8);
+	eventCount = header.Get(8);
+	endCycles = header.Get(8);
+	endHash = header.Get(8);
+
+	MovieCursor footer = {bytes, bytes.size() - MOVIE_FOOTER, true};
+	uint64_t indexOffset = footer.Get(8);
+	MovieCursor index = {bytes, size_t(indexOffset), true};
+	uint32_t count = uint32_t(footer.Get(4));
+
+	keyframeFrames.clear();
+	keyframeOffsets.clear();
+	for (uint32_t k = 0; k < count && index.ok; k++) {
+		keyframeFrames.push_back(index.Get(8));
+		keyframeOffsets.push_back(index.Get(8));
+		index.ok = index.ok && keyframeOffsets.back() >= MOVIE_HEADER && keyframeOffsets.back() < indexOffset; //between the header and the index
+	}
+
+	if (!index.ok || keyframeFrames.empty() || keyframeFrames[0] != 0
+		|| !std::is_sorted(keyframeFrames.begin(), keyframeFrames.end())) {
+		LOG_ERROR("Movie: " << filename << " has a damaged keyframe index");
+		return false;
+	}
+
+	LOG_INFO("Movie: " << filename << " holds " << frames << " frames (seed " << seed << ")");
+	return true;
+}
+
+bool MoviePlayer::Decode() {
+	if (!eventsLeft) {
+		pending.frame = UINT64_MAX;
+		return true;
+	}
+
+	MovieCursor cursor = {bytes, next, true};
+	pending.frame += cursor.Varint();
+	pending.cycle += cursor.Varint();
+	pending.keys = uint16_t(cursor.Get(2));
+	next = cursor.at;
+	--eventsLeft;
+
+	if (!cursor.ok) {
+		LOG_ERROR("Movie: the key changes are damaged");
+	}
+	return cursor.ok;
+}
+
+bool MoviePlayer::Seek(Chip8& chip, uint64_t target) {
+	if (target > frames || keyframeFrames.empty()) {
+		return false;
+	}
+
+	size_t k = std::upper_bound(keyframeFrames.begin(), keyframeFrames.end(), target) - keyframeFrames.begin() - 1;
+	MovieCursor record = {bytes, size_t(keyframeOffsets[k]), true};
+
+	uint64_t keyframe = record.Get(8);
+	uint64_t event = record.Get(8);
+	next = size_t(record.Get(8));
+	pending.frame = record.Get(8);
+	pending.cycle = record.Get(8);
+	size_t stateSize = size_t(record.Get(4));
+
+	if (!record.ok || stateSize > bytes.size() - record.at || event > eventCount || keyframe != keyframeFrames[k]
+		|| !chip.LoadStateBytes(&bytes[record.at], stateSize)) {
+		LOG_ERROR("Movie: the keyframe at frame " << keyframeFrames[k] << " is damaged");
+		return false;
+	}
+
+	frame = keyframe;
+	eventsLeft = eventCount - event;
+	if (!Decode()) {
+		return false;
+	}
+
+	while (frame < target) {
+		if (Step(chip) != RunResult::FrameComplete) {
+			return false;
+		}
+	}
+	return true;
+}
+
+RunResult MoviePlayer::Step(Chip8& chip) {
+	if (frame >= frames) {
+		return RunResult::Budget;
+	}
+
+	while (pending.frame == frame) {
+		if (chip.Cycles() != pending.cycle) {
+			++desyncs;
+		}
+		for (unsigned int key = 0; key < 16; key++) {
+			chip.keypad[key] = (pending.keys >> key) & 1u;
+		}
+		if (!Decode()) {
+			frames = frame; //play no further than the damage
+			return RunResult::Budget;
+		}
+	}
+
+	RunResult result;
+	do {
+		result = chip.RunFrame(); //as the frontend, which picks the frame up again after an Fx0A wait
+	} while (result == RunResult::WaitingForKey);
+
+	++frame;
+	return result;
+}
+
+bool MoviePlayer::Matches(Chip8 const& chip) const {
+	return chip.Cycles() == endCycles && videoKernels->hash(chip.video) == endHash;
+}
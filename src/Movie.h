@@ -0,0 +1,91 @@
+//
+// Movies: a play session recorded as its key presses, replayed frame for frame (headless or not).
+//
+#include "Chip8.h"
+#include <vector>
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+/*
+    With a fixed seed a machine is a pure function of its keypad at the start of every frame (the keypad is only read
+    while a frame runs, and the hosts only change it between frames). A movie stores that input as the frames where
+    the pressed keys changed, with the cycle count at that point so a replay can tell when it stopped following the
+    recording, plus a saved state every keyframe interval. The state at frame 0 holds the ROM, seed, speed and sprite
+    mode, so replaying needs nothing but the movie.
+
+    File layout (all numbers little endian, see Movie.cpp):
+        header      "C8MV", version, seed, keyframe interval, frames, events, cycles and display hash at the end
+        events      frame and cycle as LEB128 deltas from the event before, then the 16 key bits
+        keyframes   frame, where its events resume, then a saved state (Chip8::SaveStateBytes())
+        index       frame and file offset of every keyframe, oldest first
+        footer      offset of the index, keyframe count, "C8MX"
+
+    Seeking binary searches the index for the last keyframe at or before the frame (O(log n)), restores it and plays
+    the less than one interval of frames left.
+*/
+
+//the keys pressed from a frame on
+struct MovieEvent {
+    uint64_t frame;
+    uint64_t cycle; //Chip8::Cycles() when the frame started
+    uint16_t keys; //bit per pressed key
+};
+
+class MovieRecorder {
+private:
+    struct Keyframe {
+        uint64_t frame;
+        size_t event; //events on or before the frame (they are already in the state)
+        std::vector<uint8_t> state;
+    };
+
+    uint32_t seed;
+    uint32_t interval;
+    uint64_t frames = {}; //frames started
+    std::vector<MovieEvent> events;
+    std::vector<Keyframe> keyframes;
+
+public:
+    MovieRecorder(uint32_t, uint32_t = 1800); //seed the machine was given (for the header), frames per keyframe
+    void Frame(Chip8 const&); //call with the keypad set, right before the machine runs a frame
+    void StepBack(); //the host rewound the machine by its last frame (see Rewind), which is forgotten
+    bool Save(char const*, Chip8 const&) const; //writes the movie, with the machine as the recording left it
+
+    uint64_t Frames() const { return frames; }
+};
+
+class MoviePlayer {
+private:
+    std::vector<uint8_t> bytes; //the whole file
+    std::vector<uint64_t> keyframeFrames; //index: frame of every keyframe
+    std::vector<uint64_t> keyframeOffsets; //index: file offset of every keyframe
+
+    uint32_t seed = {};
+    uint64_t frames = {};
+    uint64_t eventCount = {};
+    uint64_t endCycles = {}; //Chip8::Cycles() when the recording stopped
+    uint64_t endHash = {}; //display hash when the recording stopped
+
+    //replay position
+    uint64_t frame = {}; //next frame to play
+    size_t next = {}; //file offset of the event after "pending"
+    uint64_t eventsLeft = {}; //events not decoded yet
+    MovieEvent pending = {}; //next event to apply (its frame is past the end once none is left)
+    uint64_t desyncs = {}; //events reached at another cycle count than recorded
+
+    bool Decode(); //moves the next event into "pending"
+
+public:
+    bool Open(char const*); //reads and checks a movie file
+    bool Seek(Chip8&, uint64_t); //puts the machine at the start of a frame, false if past the end or the file is damaged (a damaged keyframe leaves the machine alone)
+    RunResult Step(Chip8&); //plays a frame: FrameComplete, InvalidOpcode, or Budget when the movie is over
+
+    uint64_t Frame() const { return frame; }
+    uint64_t Frames() const { return frames; }
+    uint32_t Seed() const { return seed; }
+    uint64_t Desyncs() const { return desyncs; }
+    bool Matches(Chip8 const&) const; //the machine ended where the recording did (call after the last frame)
+};
+
+#endif
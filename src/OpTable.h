@@ -0,0 +1,119 @@
+//
+// Compile-time generated handler table covering all 65536 opcodes (CHIP8_DISPATCH_CONSTEXPR).
+//
+
+#include "Chip8.h"
+#include <utility>
+
+#ifndef OP_TABLE_H
+#define OP_TABLE_H
+
+/*
+    Every opcode is mapped to a canonical opcode that keeps only the fields used to pick registers or sub-operations
+    (x, y and the low nibble/byte of the 0x0, 0x8, 0xE and 0xF families). Chip8::Exec<canonical> is instantiated once
+    per canonical opcode, so register indices are compile-time constants that fold into the addressing, while
+    immediates (kk, nnn, n) are read from the runtime opcode. This keeps the table at 65536 entries but the number of
+    instantiated handlers at about 3300.
+*/
+constexpr uint16_t CanonicalOpcode(uint16_t op) {
+    return (op >> 12) == 0x0 ? ((op & 0xFF) == 0xE0 || (op & 0xFF) == 0xEE ? (op & 0x00FF) : 0x0000)
+        : (op >> 12) == 0x1 || (op >> 12) == 0x2 || (op >> 12) == 0xA || (op >> 12) == 0xB ? (op & 0xF000)
+        : (op >> 12) == 0x3 || (op >> 12) == 0x4 || (op >> 12) == 0x6 || (op >> 12) == 0x7 || (op >> 12) == 0xC ? (op & 0xFF00)
+        : (op >> 12) == 0x5 || (op >> 12) == 0x9 || (op >> 12) == 0xD ? (op & 0xFFF0)
+        : (op >> 12) == 0x8 ? ((op & 0xF) <= 0x7 || (op & 0xF) == 0xE ? op : 0x0000)
+        : (op >> 12) == 0xE ? ((op & 0xFF) == 0x9E || (op & 0xFF) == 0xA1 ? op : 0x0000)
+        : ((op & 0xFF) == 0x07 || (op & 0xFF) == 0x0A || (op & 0xFF) == 0x15 || (op & 0xFF) == 0x18 ||
+           (op & 0xFF) == 0x1E || (op & 0xFF) == 0x29 || (op & 0xFF) == 0x33 || (op & 0xFF) == 0x55 ||
+           (op & 0xFF) == 0x65) ? op : 0x0000;
+}
+
+/* One handler per canonical opcode. The switches are on template constants, so each instantiation is straight-line code. */
+template<uint16_t Op>
+void Chip8::Exec(Chip8& c, uint16_t opcode) {
+    constexpr unsigned int x = (Op >> 8) & 0xF;
+    constexpr unsigned int y = (Op >> 4) & 0xF;
+    uint8_t* const V = c.V;
+
+    switch (Op >> 12) {
+        case 0x1: c.pc = opcode & 0x0FFFu; return;
+        case 0x3: if (V[x] == (opcode & 0xFFu)) c.pc += 2; return;
+        case 0x4: if (V[x] != (opcode & 0xFFu)) c.pc += 2; return;
+        case 0x5: if (V[x] == V[y]) c.pc += 2; return;
+        case 0x6: V[x] = opcode & 0xFFu; return;
+        case 0x7: V[x] += opcode & 0xFFu; return;
+        case 0x9: if (V[x] != V[y]) c.pc += 2; return;
+        case 0xA: c.I = opcode & 0x0FFFu; return;
+        case 0xB: c.pc = V[0] + (opcode & 0x0FFFu); return;
+        case 0x8:
+            switch (Op & 0xF) {
+                case 0x0: V[x] = V[y]; return;
+                case 0x1: V[x] |= V[y]; return;
+                case 0x2: V[x] &= V[y]; return;
+                case 0x3: V[x] ^= V[y]; return;
+                case 0x4: {
+                    uint16_t sum = V[x] + V[y];
+                    V[0xF] = sum > 255U;
+                    V[x] = sum & 0xFFu;
+                    return;
+                }
+                case 0x5: V[0xF] = V[x] > V[y]; V[x] -= V[y]; return;
+                case 0x6: V[0xF] = V[x] & 0x1u; V[x] >>= 1; return;
+                case 0x7: V[0xF] = V[y] > V[x]; V[x] = V[y] - V[x]; return;
+                case 0xE: V[0xF] = (V[x] & 0x80u) >> 7u; V[x] <<= 1; return;
+            }
+            return;
+        case 0xF:
+            if ((Op & 0xFF) == 0x1E) {
+                c.I += V[x];
+                return;
+            }
+            break;
+    }
+
+    // drawing, timers, keys, memory and the stack go through the instruction methods
+    Instruction const in = Decode(opcode);
+    switch (Op >> 12) {
+        case 0x0:
+            if ((Op & 0xFF) == 0xE0) c.OP_00E0(in);
+            else if ((Op & 0xFF) == 0xEE) c.OP_00EE(in);
+            else c.OP_NULL(in);
+            return;
+        case 0x2: c.OP_2nnn(in); return;
+        case 0xC: c.OP_Cxkk(in); return;
+        case 0xD: c.OP_Dxyn(in); return;
+        case 0xE:
+            if ((Op & 0xFF) == 0x9E) c.OP_Ex9E(in);
+            else c.OP_ExA1(in);
+            return;
+        case 0xF:
+            switch (Op & 0xFF) {
+                case 0x07: c.OP_Fx07(in); return;
+                case 0x0A: c.OP_Fx0A(in); return;
+                case 0x15: c.OP_Fx15(in); return;
+                case 0x18: c.OP_Fx18(in); return;
+                case 0x29: c.OP_Fx29(in); return;
+                case 0x33: c.OP_Fx33(in); return;
+                case 0x55: c.OP_Fx55(in); return;
+                case 0x65: c.OP_Fx65(in); return;
+            }
+            return;
+    }
+}
+
+/* The table itself: FullOpTable::handlers[opcode] == &Chip8::Exec<CanonicalOpcode(opcode)> */
+template<size_t... Opcodes>
+struct OpTable {
+    static constexpr void (*handlers[sizeof...(Opcodes)])(Chip8&, uint16_t) = { &Chip8::Exec<CanonicalOpcode(Opcodes)>... };
+};
+
+template<size_t... Opcodes>
+constexpr void (*OpTable<Opcodes...>::handlers[sizeof...(Opcodes)])(Chip8&, uint16_t);
+
+template<size_t... Opcodes>
+constexpr OpTable<Opcodes...> MakeOpTable(std::index_sequence<Opcodes...>) {
+    return {};
+}
+
+typedef decltype(MakeOpTable(std::make_index_sequence<0x10000>())) FullOpTable;
+
+#endif
@@ -1,13 +1,28 @@
-#include "Classes.h"
+#include "Platform.h"
+#include <SDL2/SDL.h>
+#include "Log.h"
 
-Platform::Platform(char const* t, int width, int height, int textureWidth /*Width of texture in pixels*/, int textureHeight) {
+Platform::Platform(char const* t, int width, int height, int textureW /*Width of texture in pixels*/, int textureH) : textureWidth(textureW), textureHeight(textureH) {
     SDL_Init(SDL_INIT_VIDEO); //Initializes SDL 
     window = SDL_CreateWindow(t, 0, 0, width, height, SDL_WINDOW_SHOWN); //creates window
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED); //creates renderer which will accelerate 2D GPU processing
     SDL_RenderSetLogicalSize(renderer, width, height);
 
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight); //initializes variable that will render objects onto the window
-    std::cerr << "Platform created\n";
+    // use the renderer's own 32-bit format, so SDL doesn't convert every upload
+    SDL_RendererInfo info;
+    format = SDL_PIXELFORMAT_ARGB8888;
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+            if (!SDL_ISPIXELFORMAT_FOURCC(info.texture_formats[i]) && SDL_BYTESPERPIXEL(info.texture_formats[i]) == 4) {
+                format = info.texture_formats[i];
+                break;
+            }
+        }
+    }
+
+    texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight); //initializes variable that will render objects onto the window
+    setPalette(MONOCHROME);
+    LOG_INFO("Platform created");
 }
 
 Platform::~Platform() {
@@ -16,32 +31,76 @@ Platform::~Platform() {
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit(); 
-    std::cerr << "DESTROYED\n";
+    LOG_INFO("DESTROYED");
 }
 
-void Platform::update(void const* buffer, int pitch) {
-    SDL_UpdateTexture(texture, NULL /*represents area to update (null = update entire texture)*/, buffer, pitch); //updates texture rectangle with new pixel data
+void Platform::setPalette(Palette const& colours) {
+    SDL_PixelFormat* native = SDL_AllocFormat(format);
+
+    auto convert = [native](uint32_t rgba) {
+        return SDL_MapRGBA(native, uint8_t(rgba >> 24u), uint8_t(rgba >> 16u), uint8_t(rgba >> 8u), uint8_t(rgba));
+    };
+    palette = {convert(colours.off), convert(colours.on)};
+
+    SDL_FreeFormat(native);
+    stale = true;
+}
+
+void Platform::update(uint64_t const* rows, uint32_t version, DirtyRect const& dirty) {
+    if (!stale && version == shownVersion) { //what is on screen is still right
+        ++presentsSkipped;
+        return;
+    }
+
+    // the whole texture when it is stale, otherwise only the rows and columns drawn to since the last upload
+    DirtyRect area = stale ? DirtyRect{0, 0, uint8_t(textureWidth), uint8_t(textureHeight)} : dirty;
+
+    if (area.right) { //expands the display straight into the texture memory (locked pixels are write-only, the whole area is written)
+        SDL_Rect rect = {area.left, area.top, area.right - area.left, area.bottom - area.top};
+        void* pixels;
+        int pitch;
+
+        if (SDL_LockTexture(texture, &rect, &pixels, &pitch) == 0) {
+            ExpandVideo(rows, area, palette, static_cast<uint32_t*>(pixels), pitch);
+            SDL_UnlockTexture(texture);
+        }
+    }
+    stale = false;
+    shownVersion = version;
+    ++presentsDone;
+
     SDL_RenderClear(renderer); //Clears rendering target with the drawing colour
     SDL_RenderCopy(renderer, texture, NULL /*Entire texture*/, NULL /*Entire rendering target*/); //copy texture to current rendering target
     SDL_RenderPresent(renderer); //update the screen with rendering performed in this method
     //std::cerr << "Platform updated\n";
 }
 
-bool Platform::processInput(uint8_t* keys) {
+bool Platform::processInput(uint8_t* keys, int wait) {
     bool quit = false;
     SDL_Event event;
+    bool pending = wait > 0 ? SDL_WaitEventTimeout(&event, wait) != 0 : SDL_PollEvent(&event) != 0; //sleeps in SDL until an event or the timeout
 
-    while(SDL_PollEvent(&event)) {
+    for (; pending; pending = SDL_PollEvent(&event) != 0) {
         switch (event.type /*Reports type of event that occured on keyboard*/) {
             case SDL_QUIT:
                 quit = true;
                 break;
 
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED) { //the window contents were lost, present again
+                    stale = true;
+                }
+                break;
+
             case SDL_KEYDOWN:
                 switch(event.key.keysym.sym /*Reports which key's press value has been changed*/) { //depending on the key that is pressed, the press value (1 for pressed, 0 for not pressed) is changed
                     case SDLK_ESCAPE:
                         quit = true;
                         break;
+
+                    case SDLK_BACKSPACE:
+                        rewinding = true;
+                        break;
                     
                     case SDLK_x:
                         keys[0] = 1;
@@ -115,6 +174,10 @@ bool Platform::processInput(uint8_t* keys) {
                     case SDLK_ESCAPE:
                         quit = true;
                         break;
+
+                    case SDLK_BACKSPACE:
+                        rewinding = false;
+                        break;
                     
                     case SDLK_x:
                         keys[0] = 0;
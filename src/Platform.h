@@ -0,0 +1,38 @@
+//
+// SDL frontend: window, texture and keyboard input (the emulator core in Chip8.h does not depend on SDL).
+//
+#include "Video.h"
+#include <cstdint>
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+struct SDL_Window;
+struct SDL_Renderer; //gives program 2D GPU acceleration
+struct SDL_Texture; //makes it easy to render a 2D image
+
+class Platform {
+private:
+    SDL_Window* window = {};
+    SDL_Renderer* renderer = {};
+    SDL_Texture* texture = {};
+    uint32_t format = {}; //pixel format of the texture (the renderer's native one)
+    int textureWidth = {}, textureHeight = {};
+    Palette palette = MONOCHROME; //colours converted to the texture format
+    uint32_t shownVersion = {}; //frame version on screen
+    bool stale = true; //the window has to be redrawn whatever the version (nothing shown yet, or it was uncovered)
+
+public:
+    Platform(char const*, int, int, int, int);
+    ~Platform();
+    void setPalette(Palette const&); //colours as RGBA8888
+    void update(uint64_t const*, uint32_t, DirtyRect const&); //packed display rows, their frame version (unchanged frames are not presented) and the part that changed
+    bool processInput(uint8_t*, int = 0); //keypad, and milliseconds to block for the first event (0 only polls)
+
+    bool rewinding = false; //the rewind key (Backspace) is held down
+
+    uint64_t presentsDone = 0; //frames uploaded and presented
+    uint64_t presentsSkipped = 0; //frames left out because the video had not changed
+};
+
+#endif
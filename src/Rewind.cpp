@@ -0,0 +1,145 @@
+//
+// Rewind history (see Rewind.h)
+//
+
+#include "Rewind.h"
+#include <algorithm>
+
+/* Word of a state held as bytes */
+static inline uint64_t Word(uint8_t const* state, size_t index) {
+	uint64_t word;
+	memcpy(&word, state + index * sizeof(word), sizeof(word));
+	return word;
+}
+
+Rewind::Rewind(size_t cap, uint32_t keyframeInterval) : capacity(cap), interval(std::max(keyframeInterval, 1u)) {
+	scratch.reserve(WORDS + WORDS / 2);
+}
+
+size_t Rewind::Size(Frame const& frame) {
+	return sizeof(Frame) + (frame.delta.capacity() + frame.keyframe.capacity()) * sizeof(uint64_t);
+}
+
+void Rewind::Encode(MachineState const& next) {
+	uint8_t const* state = reinterpret_cast<uint8_t const*>(&next);
+	size_t i = 0;
+
+	scratch.clear();
+	while (i < WORDS) {
+		size_t start = i;
+		while (i < WORDS && Word(state, i) == current[i]) {
+			++i;
+		}
+		if (i == WORDS) {
+			break;
+		}
+
+		size_t header = scratch.size(), literal = i;
+		scratch.push_back(0);
+		while (i < WORDS && Word(state, i) != current[i]) {
+			scratch.push_back(Word(state, i) ^ current[i]);
+			++i;
+		}
+		scratch[header] = uint64_t(literal - start) << 32u | (i - literal); //zero words skipped, changed words that follow
+	}
+}
+
+void Rewind::Apply(std::vector<uint64_t> const& delta, uint64_t* state) {
+	size_t word = 0;
+
+	for (size_t i = 0; i < delta.size();) {
+		uint64_t header = delta[i++];
+		word += header >> 32u;
+		for (uint32_t n = uint32_t(header); n; n--) {
+			state[word++] ^= delta[i++];
+		}
+	}
+}
+
+void Rewind::Drop() {
+	Frame& newest = frames.back();
+	bytes -= Size(newest);
+	keyframes -= !newest.keyframe.empty();
+	frames.pop_back();
+	--pushed;
+}
+
+void Rewind::Evict() {
+	while (bytes > capacity && keyframes > 1) {
+		do {
+			Frame& oldest = frames.front();
+			bytes -= Size(oldest);
+			keyframes -= !oldest.keyframe.empty();
+			frames.pop_front();
+		} while (frames.front().keyframe.empty());
+
+		//nothing is older than the new oldest frame, so its delta has no use
+		bytes -= frames.front().delta.capacity() * sizeof(uint64_t);
+		std::vector<uint64_t>().swap(frames.front().delta);
+	}
+}
+
+void Rewind::Load(Chip8& chip) const {
+	MachineState state;
+	memcpy(&state, current, sizeof(state));
+	chip.RestoreState(state);
+}
+
+void Rewind::Push(Chip8 const& chip) {
+	MachineState state;
+	Frame frame;
+
+	chip.SaveState(state);
+	if (frames.empty()) {
+		pushed = 0;
+	}
+	else {
+		Encode(state);
+		frame.delta.assign(scratch.begin(), scratch.end());
+		++pushed;
+	}
+	memcpy(current, &state, sizeof(state));
+
+	if (pushed % interval == 0) {
+		frame.keyframe.assign(current, current + WORDS);
+		++keyframes;
+	}
+
+	bytes += Size(frame);
+	frames.push_back(std::move(frame));
+	Evict();
+}
+
+bool Rewind::Seek(Chip8& chip, size_t back) {
+	if (back >= frames.size()) {
+		return false;
+	}
+
+	size_t target = frames.size() - 1 - back;
+	size_t from = frames.size() - 1; //decode from the newest frame, or from the first keyframe on the way if there is one
+	for (size_t f = target; f < from && f - target < interval; f++) {
+		if (!frames[f].keyframe.empty()) {
+			from = f;
+			break;
+		}
+	}
+
+	while (frames.size() - 1 > from) {
+		Drop();
+	}
+	if (!frames.back().keyframe.empty()) {
+		std::copy(frames.back().keyframe.begin(), frames.back().keyframe.end(), current);
+	}
+	while (frames.size() - 1 > target) {
+		Apply(frames.back().delta, current);
+		Drop();
+	}
+
+	Load(chip);
+	return true;
+}
+
+void Rewind::Clear() {
+	frames.clear();
+	pushed = keyframes = bytes = 0;
+}
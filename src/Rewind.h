@@ -0,0 +1,62 @@
+//
+// Rewind history: the last frames of a machine, kept as XOR deltas between keyframes under a memory cap.
+//
+#include "Chip8.h"
+#include <deque>
+#include <vector>
+
+#ifndef REWIND_H
+#define REWIND_H
+
+/*
+    The host calls Push() after every frame and StepBack() once per frame while the rewind key is held.
+
+    Every frame is stored as the XOR of its MachineState with the frame before it. Between two frames most of the
+    4.5 KB (memory, display, stack) doesn't change, so the XOR is nearly all zero words and is run-length encoded:
+    a header word holds the number of zero words to skip and the number of words that follow, then those words.
+    A typical frame costs tens of bytes.
+
+    XOR works in both directions, so the newest frame XOR its delta is the frame before it: stepping back decodes one
+    delta and never replays anything (O(1) per frame). Every keyframe interval a full copy of the state is stored too.
+    Keyframes are where Seek() starts from (at most an interval of deltas away from any frame) and they are the unit
+    that is thrown away when the history grows past its cap: the oldest keyframe and the deltas up to the next one go
+    together, so the history always begins on a keyframe. The newest keyframe interval is never dropped, which is the
+    only way the history can be over its cap.
+*/
+class Rewind {
+private:
+    static const size_t WORDS = sizeof(MachineState) / sizeof(uint64_t); //a state as 64-bit words
+
+    struct Frame {
+        std::vector<uint64_t> delta; //run-length encoded XOR with the frame before (empty for the oldest frame)
+        std::vector<uint64_t> keyframe; //the whole state, on every keyframe interval (empty in between)
+    };
+
+    std::deque<Frame> frames; //oldest first, the back is the last frame pushed
+    uint64_t current[WORDS] = {}; //state of the newest frame
+    std::vector<uint64_t> scratch; //delta being encoded
+    size_t capacity; //bytes the history may use
+    uint32_t interval; //frames from one keyframe to the next
+    uint64_t pushed = {}; //frame number of the newest frame (keyframes are on multiples of the interval)
+    size_t keyframes = {};
+    size_t bytes = {}; //memory held by the frames
+
+    static size_t Size(Frame const&); //bytes a frame holds
+    void Encode(MachineState const&); //scratch = the delta from current to a state
+    static void Apply(std::vector<uint64_t> const&, uint64_t*); //XORs a delta into a state
+    void Drop(); //forgets the newest frame (current is left alone)
+    void Evict(); //drops the oldest keyframe interval while the history is over its cap
+    void Load(Chip8&) const; //restores current into a machine
+
+public:
+    Rewind(size_t, uint32_t = 60); //memory cap in bytes, frames per keyframe
+    void Push(Chip8 const&); //records the frame a machine has just finished
+    bool Seek(Chip8&, size_t); //goes back a number of frames at once (dropping the newer ones), false if not that many
+    bool StepBack(Chip8& chip) { return Seek(chip, 1); } //drops the newest frame and restores the one before it
+    void Clear();
+
+    size_t Frames() const { return frames.size(); }
+    size_t Bytes() const { return bytes; }
+};
+
+#endif
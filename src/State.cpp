@@ -0,0 +1,219 @@
+//
+// Saved states: a MachineState written out field by field, so state files and movie keyframes move between builds and
+// machines.
+//
+// Layout (all numbers little endian):
+//     "C8ST"         magic
+//     uint16         format version (STATE_VERSION)
+//     uint32         payload size in bytes
+//     payload        the fields of MachineState in the order Visit() lists them, each at its own width
+//
+// A field added to MachineState goes at the end of Visit() and bumps STATE_VERSION. Files of another version are
+// refused rather than guessed at, and so are states with a field no running machine could hold (see OutOfRange()).
+//
+
+#include "Chip8.h"
+#include "Log.h"
+#include <cstdio>
+#include <vector>
+
+static const char STATE_MAGIC[4] = {'C', '8', 'S', 'T'};
+static const uint16_t STATE_VERSION = 1;
+static const size_t STATE_HEADER = sizeof(STATE_MAGIC) + 2 + 4;
+
+/* Hands every field of a state to an archive, which writes or reads it (one list for both directions) */
+template<typename State, typename Archive>
+static void Visit(State& state, Archive& archive) {
+	archive(state.V);
+	archive(state.I);
+	archive(state.pc);
+	archive(state.opcode);
+	archive(state.stack);
+	archive(state.sp);
+	archive(state.delayTimer);
+	archive(state.soundTimer);
+	archive(state.delaySetAt);
+	archive(state.soundSetAt);
+	archive(state.cycles);
+	archive(state.instructionsPerSecond);
+	archive(state.cycleBase);
+	archive(state.tickBase);
+	archive(state.skippedCycles);
+	archive(state.frameVersion);
+	archive(state.dirty.left);
+	archive(state.dirty.top);
+	archive(state.dirty.right);
+	archive(state.dirty.bottom);
+	archive(state.wrapSprites);
+	archive(state.waitingForKey);
+	archive(state.waitRegister);
+	archive(state.random);
+	archive(state.keypad);
+	archive(state.video);
+	archive(state.memory);
+}
+
+/* Appends fields to a byte buffer */
+struct StateWriter {
+	std::vector<uint8_t> bytes;
+
+	template<typename T>
+	void operator()(T const& value) {
+		for (size_t b = 0; b < sizeof(T); b++) {
+			bytes.push_back(uint8_t(uint64_t(value) >> (8 * b)));
+		}
+	}
+
+	template<typename T, size_t N>
+	void operator()(T const (&values)[N]) {
+		for (T const& value : values) {
+			(*this)(value);
+		}
+	}
+};
+
+/* Takes fields back out of a byte buffer (the caller checks the size first), "ok" drops to false on a bool that isn't 0 or 1 */
+struct StateReader {
+	uint8_t const* next;
+	bool ok;
+
+	template<typename T>
+	void operator()(T& value) {
+		uint64_t word = 0;
+		for (size_t b = 0; b < sizeof(T); b++) {
+			word |= uint64_t(*next++) << (8 * b);
+		}
+		value = T(word);
+	}
+
+	void operator()(bool& value) {
+		ok = ok && *next <= 1;
+		value = *next++ != 0;
+	}
+
+	template<typename T, size_t N>
+	void operator()(T (&values)[N]) {
+		for (T& value : values) {
+			(*this)(value);
+		}
+	}
+};
+
+/*
+	First field of a read state that a machine could not have got into, nullptr if there is none. The instructions
+	index V, stack and the display with these fields unchecked, so a damaged file must not reach RestoreState().
+*/
+static char const* OutOfRange(MachineState const& state) {
+	if (state.sp > 16) {
+		return "sp";
+	}
+	if (state.waitRegister >= 16) {
+		return "waitRegister";
+	}
+	if (state.instructionsPerSecond == 0) {
+		return "instructionsPerSecond";
+	}
+	if (state.cycleBase > state.cycles) {
+		return "cycleBase";
+	}
+	if (state.dirty.right > VIDEO_WIDTH || state.dirty.bottom > VIDEO_HEIGHT
+		|| (state.dirty.right && (state.dirty.left >= state.dirty.right || state.dirty.top >= state.dirty.bottom))) {
+		return "dirty";
+	}
+	return nullptr;
+}
+
+/* Bytes Visit() produces for one state */
+static size_t PayloadSize() {
+	static const size_t size = [] {
+		MachineState state = {};
+		StateWriter writer;
+		Visit(state, writer);
+		return writer.bytes.size();
+	}();
+	return size;
+}
+
+std::vector<uint8_t> Chip8::SaveStateBytes() const {
+	StateWriter writer;
+	uint32_t size = PayloadSize();
+
+	writer.bytes.reserve(STATE_HEADER + size);
+	writer.bytes.assign(STATE_MAGIC, STATE_MAGIC + sizeof(STATE_MAGIC));
+	writer(STATE_VERSION);
+	writer(size);
+	Visit(static_cast<MachineState const&>(*this), writer);
+	return writer.bytes;
+}
+
+bool Chip8::LoadStateBytes(uint8_t const* bytes, size_t length) {
+	if (length < STATE_HEADER || memcmp(bytes, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+		LOG_ERROR("State: not a saved state");
+		return false;
+	}
+
+	StateReader reader = {bytes + sizeof(STATE_MAGIC), true};
+	uint16_t version;
+	uint32_t size;
+	reader(version);
+	reader(size);
+
+	if (version != STATE_VERSION) {
+		LOG_ERROR("State: saved as version " << version << ", this build reads version " << STATE_VERSION);
+		return false;
+	}
+	if (size != PayloadSize() || length != STATE_HEADER + size) {
+		LOG_ERROR("State: truncated or corrupt");
+		return false;
+	}
+
+	MachineState state = {};
+	Visit(state, reader);
+	if (!reader.ok) {
+		LOG_ERROR("State: a flag is neither 0 nor 1");
+		return false;
+	}
+	if (char const* field = OutOfRange(state)) {
+		LOG_ERROR("State: " << field << " is out of range");
+		return false;
+	}
+
+	RestoreState(state);
+	return true;
+}
+
+bool Chip8::SaveStateFile(char const* filename) const {
+	std::vector<uint8_t> bytes = SaveStateBytes();
+
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		LOG_ERROR("State: could not open " << filename);
+		return false;
+	}
+
+	bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	written = fclose(file) == 0 && written;
+	if (!written) {
+		LOG_ERROR("State: could not write " << filename);
+	}
+	return written;
+}
+
+bool Chip8::LoadStateFile(char const* filename) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		LOG_ERROR("State: could not open " << filename);
+		return false;
+	}
+
+	std::vector<uint8_t> bytes(STATE_HEADER + PayloadSize() + 1); //one spare byte catches files that are too long
+	bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+	fclose(file);
+
+	if (!LoadStateBytes(bytes.data(), bytes.size())) {
+		LOG_ERROR("State: " << filename << " was not loaded");
+		return false;
+	}
+	LOG_INFO("State loaded from " << filename);
+	return true;
+}
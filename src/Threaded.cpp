@@ -0,0 +1,428 @@
+//
+// Direct-threaded basic block interpreter (see Threaded.h)
+//
+
+#include "Threaded.h"
+
+// GCC/Clang jump from handler to handler through label addresses, other compilers use a switch inside the block
+#if defined(__GNUC__)
+#define THREADED_GOTO 1
+#else
+#define THREADED_GOTO 0
+#endif
+
+void const* const* Threaded::labels = nullptr;
+
+Threaded::Threaded(Chip8& c) : chip(c) {
+	if (!labels) {
+		Execute(nullptr); //publishes the handler addresses
+	}
+	chip.threaded = this;
+	Translate();
+}
+
+Threaded::~Threaded() {
+	chip.threaded = nullptr;
+}
+
+void Threaded::Translate() {
+	all.clear();
+	for (auto& block : blocks) {
+		block = nullptr;
+	}
+	for (auto& page : pages) {
+		page.clear();
+	}
+
+	// follow every statically known edge from the current pc
+	std::vector<uint16_t> work(1, chip.pc);
+	while (!work.empty()) {
+		uint16_t address = work.back();
+		work.pop_back();
+
+		if (address + 1u >= MEMSIZE || blocks[address]) {
+			continue;
+		}
+
+		Block* block = Build(address);
+		Op const& last = block->ops.back();
+
+		switch (last.kind) {
+			case T_3xkk: case T_4xkk: case T_5xy0: case T_9xy0:
+				work.push_back(last.next);
+				work.push_back(uint16_t(last.next + 2));
+				break;
+			case T_3xkk_1nnn: case T_4xkk_1nnn: case T_Ex9E_1nnn: case T_ExA1_1nnn: case T_Fx07_3xkk_1nnn:
+				work.push_back(last.next);
+				work.push_back(last.target);
+				break;
+			case T_1nnn:
+				work.push_back(last.in.nnn);
+				break;
+			case T_2nnn:
+				work.push_back(last.in.nnn);
+				work.push_back(last.next); //where the subroutine returns to
+				break;
+			case T_METHOD_END:
+				if ((last.in.opcode >> 12u) == 0xE) { //Ex9E, ExA1
+					work.push_back(last.next);
+					work.push_back(uint16_t(last.next + 2));
+				}
+				else if ((last.in.opcode & 0xF0FFu) == 0xF00Au) {
+					work.push_back(last.next);
+				}
+				break;
+			case T_NEXT:
+				work.push_back(last.next);
+				break;
+			default: //00EE and Bnnn are translated when they are reached
+				break;
+		}
+	}
+}
+
+Threaded::Block* Threaded::Build(uint16_t start) {
+	std::unique_ptr<Block> owned(new Block());
+	Block* block = owned.get();
+	block->start = start;
+	block->modified = false;
+	block->idle = chip.IdleLoop(start) != 0;
+	block->length = 0;
+
+	uint16_t address = start;
+	bool terminated = false;
+
+	while (!terminated && address + 1u < MEMSIZE && block->length < MAX_BLOCK) {
+		Op op;
+		op.in = Chip8::Decode((chip.memory[address] << 8u) | chip.memory[address + 1]);
+		op.index = uint8_t(block->length);
+		op.next = uint16_t(address + 2);
+		op.target = 0;
+		op.in2 = Instruction();
+		op.method = nullptr;
+
+		// mirrors the decoding done by Chip8::DispatchSwitch()
+		switch (op.in.opcode >> 12u) {
+			case 0x0: op.kind = op.in.kk == 0xE0 ? T_METHOD : op.in.kk == 0xEE ? T_00EE : T_METHOD_END; break;
+			case 0x1: op.kind = T_1nnn; break;
+			case 0x2: op.kind = T_2nnn; break;
+			case 0x3: op.kind = T_3xkk; break;
+			case 0x4: op.kind = T_4xkk; break;
+			case 0x5: op.kind = T_5xy0; break;
+			case 0x6: op.kind = T_6xkk; break;
+			case 0x7: op.kind = T_7xkk; break;
+			case 0x8: {
+				const Kind family8[16] = {
+					T_8xy0, T_8xy1, T_8xy2, T_8xy3, T_8xy4, T_8xy5, T_8xy6, T_8xy7,
+					T_METHOD_END, T_METHOD_END, T_METHOD_END, T_METHOD_END, T_METHOD_END, T_METHOD_END, T_8xyE, T_METHOD_END
+				};
+				op.kind = family8[op.in.n];
+				break;
+			}
+			case 0x9: op.kind = T_9xy0; break;
+			case 0xA: op.kind = T_Annn; break;
+			case 0xB: op.kind = T_Bnnn; break;
+			case 0xC: case 0xD: op.kind = T_METHOD; break;
+			case 0xE: op.kind = T_METHOD_END; break;
+			default: //0xF
+				switch (op.in.kk) {
+					case 0x1E: op.kind = T_Fx1E; break;
+					case 0x07: case 0x15: case 0x18: case 0x29: case 0x33: case 0x55: case 0x65: op.kind = T_METHOD; break;
+					default: op.kind = T_METHOD_END; break; //Fx0A and invalid opcodes
+				}
+				break;
+		}
+
+		if (op.kind == T_METHOD || op.kind == T_METHOD_END) {
+			op.method = Chip8::Lookup(op.in.opcode);
+		}
+
+		terminated = op.kind >= T_3xkk;
+		block->ops.push_back(op);
+		block->length++;
+		address += 2;
+	}
+
+	if (!terminated) { //cut short: continue with whatever follows
+		Op op = {};
+		op.kind = T_NEXT;
+		op.index = uint8_t(block->length);
+		op.next = address;
+		block->ops.push_back(op);
+	}
+	else if (address + 1u < MEMSIZE && (chip.memory[address] >> 4u) == 0x1) {
+		// a skip followed by a jump: pull the jump into the block so Fuse() can merge the two
+		Kind kind = block->ops.back().kind;
+		uint16_t pattern = block->ops.back().in.opcode & 0xF0FFu;
+
+		if (kind == T_3xkk || kind == T_4xkk || pattern == 0xE09Eu || pattern == 0xE0A1u) {
+			Op op = {};
+			op.kind = T_1nnn;
+			op.index = uint8_t(block->length);
+			op.in = Chip8::Decode((chip.memory[address] << 8u) | chip.memory[address + 1]);
+			op.next = uint16_t(address + 2);
+			block->ops.push_back(op);
+			block->length++;
+			address += 2;
+		}
+	}
+
+	Fuse(block);
+
+	for (auto& op : block->ops) {
+		op.label = labels ? labels[op.kind] : nullptr;
+	}
+
+	block->end = address;
+	blocks[start] = block;
+	for (unsigned int page = start >> PAGE_SHIFT; page <= unsigned(address - 1) >> PAGE_SHIFT; page++) {
+		pages[page].push_back(block);
+	}
+	all.push_back(std::move(owned));
+
+	return block;
+}
+
+void Threaded::Fuse(Block* block) {
+	std::vector<Op> fused;
+	fused.reserve(block->ops.size());
+
+	for (size_t i = 0; i < block->ops.size(); i++) {
+		Op op = block->ops[i];
+		Op const* second = i + 1 < block->ops.size() ? &block->ops[i + 1] : nullptr;
+		Op const* third = i + 2 < block->ops.size() ? &block->ops[i + 2] : nullptr;
+		uint16_t pattern = op.in.opcode & 0xF0FFu;
+
+		if (third && pattern == 0xF007u && second->kind == T_3xkk && third->kind == T_1nnn) {
+			op.kind = T_Fx07_3xkk_1nnn;
+			op.in2 = second->in;
+			op.target = third->in.nnn;
+			op.next = third->next;
+			i += 2;
+		}
+		else if (second && second->kind == T_1nnn &&
+				(op.kind == T_3xkk || op.kind == T_4xkk || pattern == 0xE09Eu || pattern == 0xE0A1u)) {
+			op.kind = op.kind == T_3xkk ? T_3xkk_1nnn : op.kind == T_4xkk ? T_4xkk_1nnn : pattern == 0xE09Eu ? T_Ex9E_1nnn : T_ExA1_1nnn;
+			op.target = second->in.nnn;
+			op.next = second->next;
+			i += 1;
+		}
+		else if (second && op.kind == T_6xkk && second->kind == T_6xkk) {
+			op.kind = T_6xkk_6xkk;
+			op.in2 = second->in;
+			op.next = second->next;
+			i += 1;
+		}
+		else if (second && op.kind == T_Annn && (second->in.opcode >> 12u) == 0xD) {
+			op.kind = T_Annn_Dxyn;
+			op.index = second->index; //the draw is the instruction that calls a method
+			op.in2 = second->in;
+			op.method = second->method;
+			op.next = second->next;
+			i += 1;
+		}
+
+		fused.push_back(op);
+	}
+
+	block->ops.swap(fused);
+}
+
+uint32_t Threaded::Run(uint32_t budget) {
+	uint32_t executed = 0;
+	chip.halt = RunResult::Budget;
+
+	while (executed < budget && chip.halt == RunResult::Budget) { //Fx0A and invalid opcodes end the batch early
+		uint16_t pc = chip.pc;
+		Block* block = pc < MEMSIZE ? blocks[pc] : nullptr;
+
+		if (!block && pc + 1u < MEMSIZE) {
+			block = Build(pc);
+		}
+
+		if (block && block->idle && !block->modified) { //skip the iterations that can't leave the loop
+			uint32_t skipped = chip.FastForward(budget - executed);
+			if (skipped) {
+				executed += skipped;
+				continue;
+			}
+		}
+
+		if (block && !block->modified && block->length <= budget - executed) {
+			executed += Execute(block);
+		}
+		else { //self-modified block, or not enough budget left for the whole block
+			chip.Cycle();
+			++executed;
+		}
+	}
+
+	return executed;
+}
+
+uint32_t Threaded::Execute(Block const* block) {
+#if THREADED_GOTO
+	static void const* const table[T_COUNT] = {
+		&&L_T_6xkk, &&L_T_7xkk, &&L_T_8xy0, &&L_T_8xy1, &&L_T_8xy2, &&L_T_8xy3, &&L_T_8xy4, &&L_T_8xy5, &&L_T_8xy6,
+		&&L_T_8xy7, &&L_T_8xyE, &&L_T_Annn, &&L_T_Fx1E, &&L_T_6xkk_6xkk, &&L_T_METHOD, &&L_T_Annn_Dxyn, &&L_T_3xkk,
+		&&L_T_4xkk, &&L_T_5xy0, &&L_T_9xy0, &&L_T_1nnn, &&L_T_2nnn, &&L_T_00EE, &&L_T_Bnnn, &&L_T_3xkk_1nnn,
+		&&L_T_4xkk_1nnn, &&L_T_Ex9E_1nnn, &&L_T_ExA1_1nnn, &&L_T_Fx07_3xkk_1nnn, &&L_T_METHOD_END, &&L_T_NEXT
+	};
+
+	if (!block) {
+		labels = table;
+		return 0;
+	}
+
+#define OP(kind) L_##kind
+#define NEXT() do { ++op; goto *op->label; } while (0)
+#else
+	if (!block) {
+		return 0;
+	}
+
+#define OP(kind) case kind
+#define NEXT() do { ++op; goto dispatch; } while (0)
+#endif
+
+	Op const* op = block->ops.data();
+	uint8_t* const V = chip.V;
+	uint32_t executed = block->length;
+	uint32_t synced = 0; //instructions already handed to Chip8::Tick()
+
+	// instruction methods see the machine exactly as Chip8::Cycle() would leave it before executing
+#define CALL_METHOD(instruction) do { \
+		chip.pc = op->next; \
+		chip.Tick(op->index - synced); \
+		synced = op->index; \
+		chip.opcode = (instruction).opcode; \
+		(chip.*op->method)(instruction); \
+	} while (0)
+
+#if THREADED_GOTO
+	goto *op->label;
+#else
+dispatch:
+	switch (op->kind) {
+#endif
+
+	OP(T_6xkk): V[op->in.x] = op->in.kk; NEXT();
+	OP(T_7xkk): V[op->in.x] += op->in.kk; NEXT();
+	OP(T_8xy0): V[op->in.x] = V[op->in.y]; NEXT();
+	OP(T_8xy1): V[op->in.x] |= V[op->in.y]; NEXT();
+	OP(T_8xy2): V[op->in.x] &= V[op->in.y]; NEXT();
+	OP(T_8xy3): V[op->in.x] ^= V[op->in.y]; NEXT();
+	OP(T_8xy4): {
+		uint16_t sum = V[op->in.x] + V[op->in.y];
+		V[0xF] = sum > 255U;
+		V[op->in.x] = sum & 0xFFu;
+		NEXT();
+	}
+	OP(T_8xy5):
+		V[0xF] = V[op->in.x] > V[op->in.y];
+		V[op->in.x] -= V[op->in.y];
+		NEXT();
+	OP(T_8xy6):
+		V[0xF] = V[op->in.x] & 0x1u;
+		V[op->in.x] >>= 1;
+		NEXT();
+	OP(T_8xy7):
+		V[0xF] = V[op->in.y] > V[op->in.x];
+		V[op->in.x] = V[op->in.y] - V[op->in.x];
+		NEXT();
+	OP(T_8xyE):
+		V[0xF] = (V[op->in.x] & 0x80u) >> 7u;
+		V[op->in.x] <<= 1;
+		NEXT();
+	OP(T_Annn): chip.I = op->in.nnn; NEXT();
+	OP(T_Fx1E): chip.I += V[op->in.x]; NEXT();
+	OP(T_6xkk_6xkk):
+		V[op->in.x] = op->in.kk;
+		V[op->in2.x] = op->in2.kk;
+		NEXT();
+
+	OP(T_METHOD):
+		codeChanged = false;
+		CALL_METHOD(op->in);
+		if (codeChanged) { //the method wrote into a block, so the rest of this one may be stale
+			executed = op->index + 1u;
+			goto done;
+		}
+		NEXT();
+	OP(T_Annn_Dxyn):
+		chip.I = op->in.nnn;
+		CALL_METHOD(op->in2);
+		NEXT();
+
+	OP(T_3xkk): chip.pc = V[op->in.x] == op->in.kk ? op->next + 2 : op->next; goto done;
+	OP(T_4xkk): chip.pc = V[op->in.x] != op->in.kk ? op->next + 2 : op->next; goto done;
+	OP(T_5xy0): chip.pc = V[op->in.x] == V[op->in.y] ? op->next + 2 : op->next; goto done;
+	OP(T_9xy0): chip.pc = V[op->in.x] != V[op->in.y] ? op->next + 2 : op->next; goto done;
+	OP(T_1nnn): chip.pc = op->in.nnn; goto done;
+	OP(T_2nnn):
+		chip.stack[chip.sp] = op->next;
+		++chip.sp;
+		chip.pc = op->in.nnn;
+		goto done;
+	OP(T_00EE):
+		--chip.sp;
+		chip.pc = chip.stack[chip.sp];
+		goto done;
+	OP(T_Bnnn): chip.pc = V[0] + op->in.nnn; goto done;
+
+	// fused skips: when the skip is taken the jump never runs, so one instruction fewer was executed
+#define SKIP_JUMP(condition) do { \
+		if (condition) { \
+			chip.pc = op->next; \
+			--executed; \
+		} \
+		else { \
+			chip.pc = op->target; \
+		} \
+		goto done; \
+	} while (0)
+
+	OP(T_3xkk_1nnn): SKIP_JUMP(V[op->in.x] == op->in.kk);
+	OP(T_4xkk_1nnn): SKIP_JUMP(V[op->in.x] != op->in.kk);
+	OP(T_Ex9E_1nnn): SKIP_JUMP(chip.keypad[V[op->in.x]]);
+	OP(T_ExA1_1nnn): SKIP_JUMP(!chip.keypad[V[op->in.x]]);
+	OP(T_Fx07_3xkk_1nnn):
+		chip.Tick(op->index - synced); //the timer is read as Chip8::Cycle() would see it
+		synced = op->index;
+		V[op->in.x] = chip.DelayTimer();
+		SKIP_JUMP(V[op->in2.x] == op->in2.kk);
+
+	OP(T_METHOD_END): CALL_METHOD(op->in); goto done;
+	OP(T_NEXT): chip.pc = op->next; goto done;
+
+#if !THREADED_GOTO
+	OP(T_COUNT): goto done;
+	}
+#endif
+
+#undef OP
+#undef NEXT
+#undef CALL_METHOD
+#undef SKIP_JUMP
+
+done:
+	chip.Tick(executed - synced);
+	return executed;
+}
+
+void Threaded::CodeWritten(uint16_t address, uint16_t length) {
+	if (length == 0 || address >= MEMSIZE) {
+		return;
+	}
+
+	unsigned int last = address + length > MEMSIZE ? MEMSIZE - 1 : address + length - 1u;
+
+	for (unsigned int page = address >> PAGE_SHIFT; page <= last >> PAGE_SHIFT; page++) {
+		for (Block* block : pages[page]) {
+			if (!block->modified && block->start <= last && address < block->end) {
+				block->modified = true;
+				codeChanged = true;
+			}
+		}
+	}
+}
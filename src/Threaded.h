@@ -0,0 +1,94 @@
+//
+// Direct-threaded basic block interpreter (portable middle tier, needs no executable memory).
+//
+
+#include "Chip8.h"
+#include <memory>
+#include <vector>
+
+#ifndef THREADED_H
+#define THREADED_H
+
+/*
+    When a ROM is loaded the program is translated into arrays of pre-decoded operations, one array per basic block
+    (a block ends at a jump, call, return, skip or Fx0A). Blocks are found by following the control flow from the start
+    address; targets that can't be known ahead of time (Bnnn, returns to odd places) are translated the first time
+    they are reached.
+
+    With GCC/Clang every operation holds the address of its handler and each handler jumps straight to the next one
+    (direct threading). Other compilers step through the block with a switch. Register arithmetic is executed in
+    place, everything else calls the Chip8 instruction method, so both keep the semantics of Chip8.cpp.
+
+    After decoding, a fusion pass replaces common idioms with superinstructions so they cost one dispatch:
+        6xkk 6xkk --> both loads
+        Annn Dxyn --> set I and draw
+        3xkk/4xkk/Ex9E/ExA1 1nnn --> skip over a jump (the jump is pulled into the block)
+        Fx07 3xkk 1nnn --> delay timer poll loop
+    The set was picked from the N-gram counts printed by the profile tool (profile.cpp).
+
+    A block that gets written to (self-modifying code) is never run threaded again, the interpreter
+    (Chip8::Cycle()) takes over for it.
+*/
+class Threaded {
+private:
+    static const unsigned int MAX_BLOCK = 64; //operations per block
+    static const unsigned int PAGE_SHIFT = 8; //256 byte pages for finding blocks hit by a write
+
+    //what a threaded operation does
+    enum Kind : uint8_t {
+        T_6xkk, T_7xkk, T_8xy0, T_8xy1, T_8xy2, T_8xy3, T_8xy4, T_8xy5, T_8xy6, T_8xy7, T_8xyE, T_Annn, T_Fx1E,
+        T_6xkk_6xkk, //fused pair of loads
+        T_METHOD, //runs the Chip8 instruction method and continues
+        T_Annn_Dxyn, //sets I, then runs the Chip8 instruction method of the draw and continues
+        T_3xkk, T_4xkk, T_5xy0, T_9xy0, T_1nnn, T_2nnn, T_00EE, T_Bnnn, //end the block
+        T_3xkk_1nnn, T_4xkk_1nnn, T_Ex9E_1nnn, T_ExA1_1nnn, //skip over a jump, end the block
+        T_Fx07_3xkk_1nnn, //delay timer poll, ends the block
+        T_METHOD_END, //runs the Chip8 instruction method (which sets the pc) and ends the block
+        T_NEXT, //block was cut at MAX_BLOCK: continue at the next address
+        T_COUNT
+    };
+
+    struct Op {
+        void const* label; //address of the handler (direct threading only)
+        Kind kind;
+        uint8_t index; //position in the block of the instruction that calls a method (first instruction otherwise)
+        uint16_t next; //address of the following instruction
+        uint16_t target; //jump target of the fused skip + 1nnn operations
+        Instruction in;
+        Instruction in2; //second instruction of a fused operation
+        Chip8::Handler method; //instruction method for T_METHOD, T_Annn_Dxyn and T_METHOD_END
+    };
+
+    struct Block {
+        uint16_t start; //first address covered
+        uint16_t end; //one past the last address covered
+        uint32_t length; //instructions executed by a full run of the block
+        bool modified; //code was written to, run through the interpreter from now on
+        bool idle; //starts with a busy-wait loop (see Chip8::IdleLoop())
+        std::vector<Op> ops;
+    };
+
+    Chip8& chip;
+    std::vector<std::unique_ptr<Block>> all;
+    Block* blocks[MEMSIZE] = {}; //block starting at each address
+    std::vector<Block*> pages[MEMSIZE >> PAGE_SHIFT]; //blocks overlapping each page
+    bool codeChanged = false; //set when a write hit a block
+
+    static void const* const* labels; //handler addresses published by Execute()
+
+    Block* Build(uint16_t); //translates the block starting at an address
+    static void Fuse(Block*); //merges runs of operations into superinstructions
+    uint32_t Execute(Block const*); //runs a whole block, returns the instructions executed
+
+public:
+    explicit Threaded(Chip8&);
+    ~Threaded();
+    Threaded(Threaded const&) = delete;
+    Threaded& operator=(Threaded const&) = delete;
+
+    void Translate(); //translates the program in memory (called when a ROM is loaded)
+    uint32_t Run(uint32_t); //executes up to the given number of instructions (less on Fx0A or an invalid opcode), returns how many ran
+    void CodeWritten(uint16_t, uint16_t); //marks the blocks overlapping the written bytes as modified
+};
+
+#endif
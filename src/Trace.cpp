@@ -0,0 +1,129 @@
+//
+// Binary instruction trace (see Trace.h)
+//
+
+#include "Trace.h"
+#include "Log.h"
+#include <chrono>
+#include <vector>
+
+Tracer::Tracer(Chip8& c, char const* filename, bool stream) : chip(c), streaming(stream) {
+	file = std::fopen(filename, "wb");
+	if (!file) {
+		LOG_ERROR("Trace: could not open " << filename);
+	}
+	else {
+		std::fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file);
+	}
+
+	chip.tracer = this;
+
+	if (streaming) {
+		writer = std::thread(&Tracer::Writer, this);
+	}
+}
+
+Tracer::~Tracer() {
+	chip.tracer = nullptr;
+
+	if (streaming) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		writer.join(); //drains whatever is left on its way out
+	}
+
+	if (file) {
+		std::fclose(file);
+	}
+}
+
+bool Tracer::Read(uint64_t number, TraceRecord& record) const {
+	Slot const& slot = slots[number & (CAPACITY - 1)];
+
+	uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+	if (sequence != 2 * number + 2) { //not written yet, being written, or already overwritten
+		return false;
+	}
+
+	uint64_t word = slot.words[0].load(std::memory_order_relaxed);
+	uint64_t low = slot.words[1].load(std::memory_order_relaxed);
+	uint64_t high = slot.words[2].load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.sequence.load(std::memory_order_relaxed) != sequence) { //overwritten while copying
+		return false;
+	}
+
+	record.pc = uint16_t(word);
+	record.opcode = uint16_t(word >> 16u);
+	record.I = uint16_t(word >> 32u);
+	record.sp = uint8_t(word >> 48u);
+	record.delayTimer = uint8_t(word >> 56u);
+	std::memcpy(record.V, &low, 8);
+	std::memcpy(record.V + 8, &high, 8);
+	return true;
+}
+
+void Tracer::Drain() {
+	uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t lost = 0;
+	std::vector<TraceRecord> batch;
+
+	if (end - drained > CAPACITY) { //the ring wrapped around before these were written
+		lost = end - CAPACITY - drained;
+		drained = end - CAPACITY;
+	}
+
+	auto gap = [&]() {
+		TraceRecord record = {};
+		record.pc = 0xFFFF;
+		std::memcpy(record.V, &lost, sizeof(lost));
+		batch.push_back(record);
+		lost = 0;
+	};
+
+	for (; drained < end; drained++) {
+		TraceRecord record;
+		if (!Read(drained, record)) {
+			++lost;
+			continue;
+		}
+		if (lost) {
+			gap();
+		}
+		batch.push_back(record);
+	}
+	if (lost) {
+		gap();
+	}
+
+	if (file && !batch.empty()) {
+		std::fwrite(batch.data(), sizeof(TraceRecord), batch.size(), file);
+	}
+}
+
+void Tracer::Writer() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (!stopping) {
+		Drain();
+		wake.wait_for(lock, std::chrono::milliseconds(1), [this] { return stopping; });
+	}
+
+	Drain();
+	if (file) {
+		std::fflush(file);
+	}
+}
+
+void Tracer::Dump() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Drain();
+	if (file) {
+		std::fflush(file);
+	}
+}
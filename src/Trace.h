@@ -0,0 +1,96 @@
+//
+// Binary instruction trace: a lock-free ring of the last instructions, drained to a file by a background thread.
+//
+#include "Chip8.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+    Chip8::Cycle() writes one record per instruction (the state before it runs) into a ring of fixed size. The emulator
+    thread is the only writer and never blocks or formats anything: when the ring is full the oldest record is
+    overwritten. Each slot is a tiny seqlock (sequence number + three atomic words), so a reader can copy slots while
+    they are written and throw away the ones that were overwritten under it.
+
+    Two ways to use it:
+        streaming --> a background thread copies new records into the file as they come (gaps are marked if it falls
+                      more than a ring behind)
+        on demand --> records only stay in memory, Dump() writes the last CAPACITY of them
+
+    Dump() is called automatically on an invalid opcode, and the file can be turned into text with the tracedump tool.
+    Attaching a Tracer makes Chip8::RunCycles() step with Chip8::Cycle(), the threaded engine and the JIT don't trace.
+*/
+
+//one traced instruction as stored in the file (little-endian, 24 bytes)
+struct TraceRecord {
+    uint16_t pc; //address of the instruction (0xFFFF marks a gap, see "lost")
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t sp;
+    uint8_t delayTimer;
+    uint8_t V[16]; //registers before the instruction ran (a gap record holds the number of lost records instead)
+};
+
+const char TRACE_MAGIC[8] = {'C', '8', 'T', 'R', 'A', 'C', 'E', '1'}; //file header, followed by the records
+
+class Tracer {
+public:
+    static const uint32_t CAPACITY = 1u << 14; //records kept in memory (power of two)
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence; //2 * record number + 2 once written, odd while being written
+        std::atomic<uint64_t> words[3]; //pc, opcode, I, sp, delay timer | V0-V7 | V8-VF
+    };
+
+    Chip8& chip;
+    Slot slots[CAPACITY] = {};
+    std::atomic<uint64_t> head = {0}; //number of records written so far (only changed by the emulator thread)
+
+    FILE* file = {};
+    uint64_t drained = 0; //next record number the file is waiting for
+    std::mutex mutex; //guards the file and "drained"
+    std::condition_variable wake;
+    bool stopping = false;
+    bool streaming;
+    std::thread writer; //only when streaming
+
+    bool Read(uint64_t, TraceRecord&) const; //copies a record if it is still in the ring
+    void Drain(); //copies the records from "drained" up to the head into the file (mutex held)
+    void Writer(); //background thread of the streaming mode
+
+public:
+    Tracer(Chip8&, char const*, bool); //file name, and whether to stream every record or only dump on demand
+    ~Tracer();
+    Tracer(Tracer const&) = delete;
+    Tracer& operator=(Tracer const&) = delete;
+
+    //called by Chip8::Cycle() before every instruction
+    void Record(uint16_t pc, uint16_t opcode, uint16_t I, uint8_t sp, uint8_t delayTimer, uint8_t const* V) {
+        uint64_t number = head.load(std::memory_order_relaxed);
+        Slot& slot = slots[number & (CAPACITY - 1)];
+        uint64_t low, high;
+
+        slot.sequence.store(2 * number + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.words[0].store(pc | uint64_t(opcode) << 16u | uint64_t(I) << 32u | uint64_t(sp) << 48u |
+            uint64_t(delayTimer) << 56u, std::memory_order_relaxed);
+        std::memcpy(&low, V, 8);
+        std::memcpy(&high, V + 8, 8);
+        slot.words[1].store(low, std::memory_order_relaxed);
+        slot.words[2].store(high, std::memory_order_relaxed);
+
+        slot.sequence.store(2 * number + 2, std::memory_order_release);
+        head.store(number + 1, std::memory_order_release);
+    }
+
+    void Dump(); //writes everything not in the file yet (the last CAPACITY records at most) and flushes it
+};
+
+#endif
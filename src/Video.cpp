@@ -0,0 +1,344 @@
+//
+// Framebuffer kernels (see Video.h)
+//
+
+#include "Video.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VIDEO_X86 1
+#else
+#define VIDEO_X86 0
+#endif
+
+/*
+    Keys of the display hash, two per row. Each row is hashed as (low half + key) * (high half + key) in 32-bit lanes and
+    the products are summed, which is the same whatever the order or width of the lanes. fmix64 mixes the sum at the end.
+*/
+static const uint32_t HASH_KEYS[2 * VIDEO_HEIGHT] = {
+	0x9E3779B9, 0x7F4A7C15, 0xF39CC060, 0x5CEDC834, 0x1082276B, 0xF3A27251, 0xF86C6A11, 0xD0C18E95,
+	0x2767F0B1, 0x53A3C5A2, 0x61C88646, 0x80B583EB, 0xC2B2AE3D, 0x27D4EB2F, 0x165667B1, 0x85EBCA77,
+	0x27220A95, 0x0BF58476, 0xD1B54A32, 0xD192ED03, 0x8CB92BA7, 0x2D358DCC, 0xA0761D64, 0x78BD642F,
+	0xE7037ED1, 0xA0B428DB, 0x8EBC6AF0, 0x9C5D1B2B, 0x589965CC, 0x75374CC3, 0x1D8E4E27, 0xC2B2AE35,
+	0x94D049BB, 0x133111EB, 0xBF58476D, 0x1CE4E5B9, 0xFF51AFD7, 0xED558CCD, 0xC4CEB9FE, 0x1A85EC53,
+	0x85EBCA6B, 0xCC9E2D51, 0x1B873593, 0xE6546B64, 0x38B34AE5, 0xA1B2C3D4, 0x5851F42D, 0x4C957F2D,
+	0x14057B7E, 0xF767814F, 0xDA942042, 0xE4DD58B5, 0x2545F491, 0x4F6CDD1D, 0x9FB21C65, 0x1F83D9AB,
+	0x5BE0CD19, 0x137E2179, 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C
+};
+
+static uint64_t FinishHash(uint64_t sum) {
+	sum ^= sum >> 33u;
+	sum *= 0xFF51AFD7ED558CCDull;
+	sum ^= sum >> 33u;
+	sum *= 0xC4CEB9FE1A85EC53ull;
+	sum ^= sum >> 33u;
+	return sum;
+}
+
+/* Row "y" of an output buffer */
+static uint32_t* OutputRow(uint32_t* pixels, int pitch, unsigned int y) {
+	return reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(pixels) + y * pitch);
+}
+
+/* Pixels from "x" to "width" of a row whose first pixel is bit 63 of "bits" */
+static void ExpandTail(uint64_t bits, unsigned int x, unsigned int width, Palette const& palette, uint32_t* out) {
+	uint32_t flip = palette.on ^ palette.off;
+
+	for (; x < width; x++) {
+		uint32_t lit = uint32_t(bits >> (63u - x)) & 1u;
+		out[x] = palette.off ^ (flip & (0u - lit)); //no branch per pixel
+	}
+}
+
+/* A sprite byte turned into the mask of its row (columns past the right edge fall off, or come back in on the left) */
+static uint64_t SpriteMask(uint8_t byte, unsigned int x, bool wrap) {
+	uint64_t bits = uint64_t(byte) << 56u;
+	uint64_t mask = bits >> x;
+	if (wrap) {
+		mask |= bits << ((VIDEO_WIDTH - x) & 63u);
+	}
+	return mask;
+}
+
+
+/* Scalar kernels */
+
+static void ClearScalar(uint64_t* rows) {
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+		rows[y] = 0;
+	}
+}
+
+static uint64_t BlitScalar(uint64_t* rows, uint8_t const* sprite, unsigned int count, unsigned int x, bool wrap) {
+	uint64_t collided = 0;
+
+	for (unsigned int r = 0; r < count; r++) {
+		uint64_t mask = SpriteMask(sprite[r], x, wrap);
+		collided |= rows[r] & mask;
+		rows[r] ^= mask;
+	}
+
+	return collided;
+}
+
+static void ExpandScalar(uint64_t const* rows, DirtyRect const& area, Palette const& palette, uint32_t* pixels, int pitch) {
+	unsigned int width = area.right - area.left;
+
+	for (unsigned int y = area.top; y < area.bottom; y++) {
+		ExpandTail(rows[y] << area.left, 0, width, palette, OutputRow(pixels, pitch, y - area.top));
+	}
+}
+
+static uint64_t HashScalar(uint64_t const* rows) {
+	uint64_t sum = 0;
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+		uint32_t low = uint32_t(rows[y]) + HASH_KEYS[2 * y];
+		uint32_t high = uint32_t(rows[y] >> 32u) + HASH_KEYS[2 * y + 1];
+		sum += uint64_t(low) * high;
+	}
+
+	return FinishHash(sum);
+}
+
+static bool EqualScalar(uint64_t const* rows, uint64_t const* other) {
+	uint64_t difference = 0;
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+		difference |= rows[y] ^ other[y];
+	}
+
+	return difference == 0;
+}
+
+
+#if VIDEO_X86
+/* SSE2 kernels: two rows per register */
+
+__attribute__((target("sse2")))
+static void ClearSSE2(uint64_t* rows) {
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 2) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rows + y), _mm_setzero_si128());
+	}
+}
+
+__attribute__((target("sse2")))
+static uint64_t BlitSSE2(uint64_t* rows, uint8_t const* sprite, unsigned int count, unsigned int x, bool wrap) {
+	const __m128i right = _mm_cvtsi32_si128(int(x));
+	const __m128i left = _mm_cvtsi32_si128(int((VIDEO_WIDTH - x) & 63u));
+	__m128i collided = _mm_setzero_si128();
+	unsigned int r = 0;
+
+	for (; r + 2 <= count; r += 2) {
+		__m128i bits = _mm_set_epi64x(int64_t(uint64_t(sprite[r + 1]) << 56u), int64_t(uint64_t(sprite[r]) << 56u));
+		__m128i mask = _mm_srl_epi64(bits, right);
+		if (wrap) {
+			mask = _mm_or_si128(mask, _mm_sll_epi64(bits, left));
+		}
+		__m128i line = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rows + r));
+		collided = _mm_or_si128(collided, _mm_and_si128(line, mask));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rows + r), _mm_xor_si128(line, mask));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), collided);
+	return lanes[0] | lanes[1] | BlitScalar(rows + r, sprite + r, count - r, x, wrap);
+}
+
+/* Broadcasts 4 display bits to 4 lanes, tests one bit per lane and picks the colour with the resulting mask */
+__attribute__((target("sse2")))
+static void ExpandSSE2(uint64_t const* rows, DirtyRect const& area, Palette const& palette, uint32_t* pixels, int pitch) {
+	const __m128i select = _mm_setr_epi32(8, 4, 2, 1);
+	const __m128i off = _mm_set1_epi32(int(palette.off));
+	const __m128i flip = _mm_set1_epi32(int(palette.on ^ palette.off));
+	unsigned int width = area.right - area.left;
+
+	for (unsigned int y = area.top; y < area.bottom; y++) {
+		uint64_t bits = rows[y] << area.left;
+		uint32_t* out = OutputRow(pixels, pitch, y - area.top);
+		unsigned int x = 0;
+
+		for (; x + 4 <= width; x += 4) {
+			__m128i nibble = _mm_set1_epi32(int(bits >> (60u - x)) & 0xF);
+			__m128i lit = _mm_cmpeq_epi32(_mm_and_si128(nibble, select), select);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_xor_si128(off, _mm_and_si128(flip, lit)));
+		}
+		ExpandTail(bits, x, width, palette, out);
+	}
+}
+
+/* (low + key) * (high + key) of two rows with one 32x32->64 bit multiply */
+__attribute__((target("sse2")))
+static uint64_t HashSSE2(uint64_t const* rows) {
+	__m128i sum = _mm_setzero_si128();
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 2) {
+		__m128i keyed = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(rows + y)),
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(HASH_KEYS + 2 * y)));
+		sum = _mm_add_epi64(sum, _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32)));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+	return FinishHash(lanes[0] + lanes[1]);
+}
+
+__attribute__((target("sse2")))
+static bool EqualSSE2(uint64_t const* rows, uint64_t const* other) {
+	__m128i difference = _mm_setzero_si128();
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 2) {
+		difference = _mm_or_si128(difference, _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const*>(rows + y)),
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(other + y))));
+	}
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) == 0xFFFF;
+}
+
+
+/* AVX2 kernels: four rows per register, the same steps as the SSE2 ones */
+
+__attribute__((target("avx2")))
+static void ClearAVX2(uint64_t* rows) {
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 4) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rows + y), _mm256_setzero_si256());
+	}
+}
+
+__attribute__((target("avx2")))
+static uint64_t BlitAVX2(uint64_t* rows, uint8_t const* sprite, unsigned int count, unsigned int x, bool wrap) {
+	const __m128i right = _mm_cvtsi32_si128(int(x));
+	const __m128i left = _mm_cvtsi32_si128(int((VIDEO_WIDTH - x) & 63u));
+	__m256i collided = _mm256_setzero_si256();
+	unsigned int r = 0;
+
+	for (; r + 4 <= count; r += 4) {
+		__m256i bits = _mm256_set_epi64x(int64_t(uint64_t(sprite[r + 3]) << 56u), int64_t(uint64_t(sprite[r + 2]) << 56u),
+			int64_t(uint64_t(sprite[r + 1]) << 56u), int64_t(uint64_t(sprite[r]) << 56u));
+		__m256i mask = _mm256_srl_epi64(bits, right);
+		if (wrap) {
+			mask = _mm256_or_si256(mask, _mm256_sll_epi64(bits, left));
+		}
+		__m256i line = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rows + r));
+		collided = _mm256_or_si256(collided, _mm256_and_si256(line, mask));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rows + r), _mm256_xor_si256(line, mask));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), collided);
+	return lanes[0] | lanes[1] | lanes[2] | lanes[3] | BlitScalar(rows + r, sprite + r, count - r, x, wrap);
+}
+
+__attribute__((target("avx2")))
+static void ExpandAVX2(uint64_t const* rows, DirtyRect const& area, Palette const& palette, uint32_t* pixels, int pitch) {
+	const __m256i select = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1);
+	const __m256i off = _mm256_set1_epi32(int(palette.off));
+	const __m256i flip = _mm256_set1_epi32(int(palette.on ^ palette.off));
+	unsigned int width = area.right - area.left;
+
+	for (unsigned int y = area.top; y < area.bottom; y++) {
+		uint64_t bits = rows[y] << area.left;
+		uint32_t* out = OutputRow(pixels, pitch, y - area.top);
+		unsigned int x = 0;
+
+		for (; x + 8 <= width; x += 8) {
+			__m256i byte = _mm256_set1_epi32(int(bits >> (56u - x)) & 0xFF);
+			__m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(byte, select), select);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_xor_si256(off, _mm256_and_si256(flip, lit)));
+		}
+		ExpandTail(bits, x, width, palette, out);
+	}
+}
+
+__attribute__((target("avx2")))
+static uint64_t HashAVX2(uint64_t const* rows) {
+	__m256i sum = _mm256_setzero_si256();
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 4) {
+		__m256i keyed = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(rows + y)),
+			_mm256_loadu_si256(reinterpret_cast<__m256i const*>(HASH_KEYS + 2 * y)));
+		sum = _mm256_add_epi64(sum, _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32)));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+	return FinishHash(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static bool EqualAVX2(uint64_t const* rows, uint64_t const* other) {
+	__m256i difference = _mm256_setzero_si256();
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 4) {
+		difference = _mm256_or_si256(difference, _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(rows + y)),
+			_mm256_loadu_si256(reinterpret_cast<__m256i const*>(other + y))));
+	}
+
+	return _mm256_testz_si256(difference, difference) != 0;
+}
+#endif
+
+
+/* Registry */
+
+static const VideoKernels KERNELS[] = {
+#if VIDEO_X86
+	{"avx2", ClearAVX2, BlitAVX2, ExpandAVX2, HashAVX2, EqualAVX2},
+	{"sse2", ClearSSE2, BlitSSE2, ExpandSSE2, HashSSE2, EqualSSE2},
+#endif
+	{"scalar", ClearScalar, BlitScalar, ExpandScalar, HashScalar, EqualScalar}
+};
+
+/* The CPU can run a set (cpuid is only read once, by __builtin_cpu_init) */
+static bool Supported(VideoKernels const& kernels) {
+#if VIDEO_X86
+	__builtin_cpu_init();
+	if (kernels.clear == ClearAVX2) {
+		return __builtin_cpu_supports("avx2");
+	}
+	if (kernels.clear == ClearSSE2) {
+		return __builtin_cpu_supports("sse2");
+	}
+#endif
+	return true;
+}
+
+/* Fastest supported set, unless CHIP8_KERNELS names another one */
+static VideoKernels const* PickKernels() {
+	if (char const* name = std::getenv("CHIP8_KERNELS")) {
+		for (VideoKernels const& kernels : KERNELS) {
+			if (std::strcmp(kernels.name, name) == 0 && Supported(kernels)) {
+				return &kernels;
+			}
+		}
+		//runs before main(), so this can't go through the log
+		std::cerr << "CHIP8_KERNELS=" << name << " is unknown or not supported by this CPU, using the fastest supported kernels\n";
+	}
+
+	for (VideoKernels const& kernels : KERNELS) {
+		if (Supported(kernels)) {
+			return &kernels;
+		}
+	}
+	return &KERNELS[0];
+}
+
+VideoKernels const* videoKernels = PickKernels();
+
+bool VideoKernelsSupported(char const* name) {
+	for (VideoKernels const& kernels : KERNELS) {
+		if (std::strcmp(kernels.name, name) == 0) {
+			return Supported(kernels);
+		}
+	}
+	return false;
+}
+
+bool UseVideoKernels(char const* name) {
+	for (VideoKernels const& kernels : KERNELS) {
+		if (std::strcmp(kernels.name, name) == 0 && Supported(kernels)) {
+			videoKernels = &kernels;
+			return true;
+		}
+	}
+	return false;
+}
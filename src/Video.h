@@ -0,0 +1,45 @@
+//
+// Framebuffer kernels: operations on the packed display of Chip8::video (one bit per pixel, one word per row), and its
+// expansion to 32-bit pixels for a host to show.
+//
+#include "Chip8.h"
+
+#ifndef VIDEO_H
+#define VIDEO_H
+
+//colours of unlit and lit pixels, as 32-bit words in the pixel format of the destination (RGBA8888 unless a host converts them)
+struct Palette {
+    uint32_t off;
+    uint32_t on;
+};
+
+const Palette MONOCHROME = {0x00000000, 0xFFFFFFFF}; //black and white
+
+/*
+    One implementation of every framebuffer operation. All of them give the same results, they only differ in speed:
+        avx2 --> 4 rows or 8 pixels per instruction
+        sse2 --> 2 rows or 4 pixels per instruction (every x86-64 CPU)
+        scalar --> a word or a pixel at a time, branchless (any other CPU)
+
+    The fastest set the CPU supports is picked at startup, CHIP8_KERNELS=<name> forces one (to compare them on one machine).
+*/
+struct VideoKernels {
+    char const* name;
+    void (*clear)(uint64_t* rows); //00E0
+    uint64_t (*blit)(uint64_t* rows, uint8_t const* sprite, unsigned int count, unsigned int x, bool wrap); //Dxyn: XORs sprite bytes into consecutive rows at column x, returns the pixels that were already lit
+    void (*expand)(uint64_t const* rows, DirtyRect const&, Palette const&, uint32_t* pixels, int pitch); //writes the pixels inside a rectangle to a buffer that starts at its top left pixel (pitch in bytes)
+    uint64_t (*hash)(uint64_t const* rows); //64-bit hash of the whole display
+    bool (*equal)(uint64_t const* rows, uint64_t const* other); //two displays show the same pixels
+};
+
+extern VideoKernels const* videoKernels; //set in use (picked once at startup)
+
+bool UseVideoKernels(char const*); //switches to a set by name, false if it is unknown or the CPU lacks it
+bool VideoKernelsSupported(char const*); //the CPU can run the set of that name (also how other SIMD code checks for AVX2)
+
+//expands a rectangle of the display with the kernels in use (e.g. straight into a locked texture)
+inline void ExpandVideo(uint64_t const* rows, DirtyRect const& area, Palette const& palette, uint32_t* pixels, int pitch) {
+    videoKernels->expand(rows, area, palette, pixels, pitch);
+}
+
+#endif
@@ -0,0 +1,259 @@
+//
+// Batch runner: runs many ROM jobs headless in one process, spread over all cores, and prints one report line per job.
+//
+// Job file, one job per line ('#' starts a comment):
+//     <Rom> <Frames> [Seed] [Inputs]
+// Inputs is an optional script of key changes, one "<Frame> <Key> <0|1>" per line (key in hex), applied before that frame.
+// A job stops after its frames, or earlier on an invalid opcode, a jump to itself, or an Fx0A wait no script event can end.
+// Every job is seeded (0 when no seed is given) and runs on emulated time only, so the hash, cycles and exit reason of a
+// job are the same whatever the number of threads.
+//
+
+#include "Chip8.h"
+#include "Threaded.h"
+#include "Video.h"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#if CHIP8_JIT
+#include "Jit.h"
+#endif
+
+struct KeyEvent {
+	long frame;
+	uint8_t key;
+	uint8_t pressed;
+};
+
+struct Job {
+	std::string rom;
+	long frames;
+	uint32_t seed;
+	std::string inputs;
+};
+
+struct Result {
+	long frames; //frames completed
+	uint64_t cycles;
+	uint64_t hash; //VideoKernels::hash of the final display
+	double milliseconds; //wall time
+	char const* exit;
+};
+
+/*
+	Work-stealing pool: every worker owns a deque of job indices, dealt out in contiguous chunks. A worker takes jobs
+	from the back of its own deque and, once it is empty, steals from the front of the others. No jobs are added while
+	it runs, so a worker is done when every deque is empty.
+*/
+class StealingPool {
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> jobs;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	bool Take(size_t worker, size_t& job) {
+		Queue& own = *queues[worker];
+		{
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty()) {
+				job = own.jobs.back();
+				own.jobs.pop_back();
+				return true;
+			}
+		}
+
+		for (size_t i = 1; i < queues.size(); i++) {
+			Queue& victim = *queues[(worker + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				job = victim.jobs.front();
+				victim.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	template<typename Function>
+	void Run(size_t count, unsigned int threads, Function work) {
+		queues.clear();
+		for (unsigned int t = 0; t < threads; t++) {
+			queues.emplace_back(new Queue());
+		}
+		for (size_t job = 0; job < count; job++) {
+			queues[job * threads / count]->jobs.push_back(job);
+		}
+
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t < threads; t++) {
+			workers.emplace_back([this, t, &work]() {
+				size_t job;
+				while (Take(t, job)) {
+					work(job);
+				}
+			});
+		}
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+};
+
+static bool ReadInputs(std::string const& filename, std::vector<KeyEvent>& events) {
+	std::ifstream file(filename);
+	if (!file) {
+		return false;
+	}
+
+	KeyEvent event;
+	unsigned int key, pressed;
+	while (file >> event.frame >> std::hex >> key >> std::dec >> pressed) {
+		event.key = uint8_t(key & 0xF);
+		event.pressed = pressed ? 1 : 0;
+		events.push_back(event);
+	}
+	std::stable_sort(events.begin(), events.end(), [](KeyEvent const& a, KeyEvent const& b) { return a.frame < b.frame; });
+	return true;
+}
+
+static Result RunJob(Job const& job) {
+	Result result = {0, 0, 0, 0, "frames"};
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<KeyEvent> events;
+	std::unique_ptr<Chip8> chip(new Chip8());
+	Threaded threaded(*chip);
+#if CHIP8_JIT
+	Jit jit(*chip); //without executable memory it stays detached and the threaded engine runs the job
+#endif
+	chip->Seed(job.seed);
+
+	//a ROM that can't be loaded fails this job only, the other workers carry on
+	if (!chip->loadROM(job.rom.c_str()) || (!job.inputs.empty() && !ReadInputs(job.inputs, events))) {
+		result.exit = "file_error";
+		return result;
+	}
+
+	size_t next = 0; //first script event not applied yet
+	while (result.frames < job.frames) {
+		for (; next < events.size() && events[next].frame <= result.frames; next++) {
+			chip->keypad[events[next].key] = events[next].pressed;
+		}
+
+		RunResult run = chip->RunFrame();
+		if (run == RunResult::InvalidOpcode) {
+			result.exit = "invalid_opcode";
+			break;
+		}
+		if (run != RunResult::FrameComplete) {
+			continue; //an Fx0A wait started, the rest of the frame idles
+		}
+		++result.frames;
+
+		if (chip->Halted()) {
+			result.exit = "halted";
+			break;
+		}
+		if (chip->WaitingForKey() && next == events.size()) {
+			result.exit = "waiting_for_key";
+			break;
+		}
+	}
+
+	result.cycles = chip->Cycles();
+	result.hash = videoKernels->hash(chip->video);
+	result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+/* A ROM path as a JSON string body */
+static std::string Escaped(std::string const& text) {
+	std::string escaped;
+
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 4) {
+		std::cerr << "Usage: " << argv[0] << " <Jobs> [Threads] [csv|json]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	const char* jobsFilename = argv[1];
+	unsigned int threads = argc > 2 ? std::stoul(argv[2]) : 0; //0 uses every core
+	bool json = argc > 3 && std::string(argv[3]) == "json";
+
+	if (!threads) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	std::ifstream file(jobsFilename);
+	if (!file) {
+		std::cerr << "Could not open " << jobsFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	std::vector<Job> jobs;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields(line.substr(0, line.find('#')));
+		Job job = {"", 0, 0, ""};
+		if (fields >> job.rom >> job.frames) {
+			fields >> job.seed >> job.inputs;
+			jobs.push_back(job);
+		}
+	}
+
+	std::vector<Result> results(jobs.size());
+	auto start = std::chrono::steady_clock::now();
+
+	StealingPool pool;
+	pool.Run(jobs.size(), std::min<size_t>(threads, std::max<size_t>(jobs.size(), 1)), [&](size_t job) {
+		results[job] = RunJob(jobs[job]); //every job has its own slot, no locking needed
+	});
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// the report lists the jobs in file order
+	if (json) {
+		std::printf("[\n");
+	}
+	else {
+		std::printf("job,rom,seed,frames,cycles,hash,wall_ms,exit\n");
+	}
+	for (size_t i = 0; i < jobs.size(); i++) {
+		Result const& r = results[i];
+		if (json) {
+			std::printf("  {\"job\": %zu, \"rom\": \"%s\", \"seed\": %u, \"frames\": %ld, \"cycles\": %llu, \"hash\": \"%016llx\", "
+				"\"wall_ms\": %.3f, \"exit\": \"%s\"}%s\n", i, Escaped(jobs[i].rom).c_str(), jobs[i].seed, r.frames,
+				static_cast<unsigned long long>(r.cycles), static_cast<unsigned long long>(r.hash), r.milliseconds, r.exit,
+				i + 1 < jobs.size() ? "," : "");
+		}
+		else {
+			std::printf("%zu,%s,%u,%ld,%llu,%016llx,%.3f,%s\n", i, jobs[i].rom.c_str(), jobs[i].seed, r.frames,
+				static_cast<unsigned long long>(r.cycles), static_cast<unsigned long long>(r.hash), r.milliseconds, r.exit);
+		}
+	}
+	if (json) {
+		std::printf("]\n");
+	}
+
+	std::cerr << jobs.size() << " jobs on " << threads << " threads in " << seconds << " s\n";
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+//
+// Headless throughput benchmark: runs a ROM through Chip8::Cycle() and reports instructions per second.
+// Build once per engine (make bench DISPATCH=...) and compare the numbers on the same machine.
+// Also times the framebuffer kernels in use, run with CHIP8_KERNELS=scalar|sse2|avx2 to compare them, and a save state
+// snapshot and restore.
+//
+
+#include "Chip8.h"
+#include "Video.h"
+#include <memory>
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_SWITCH
+#define ENGINE_NAME "switch"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_TABLE
+#define ENGINE_NAME "table"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_GOTO
+#define ENGINE_NAME "goto"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_CACHED
+#define ENGINE_NAME "cached"
+#else
+#define ENGINE_NAME "constexpr"
+#endif
+
+/* Average nanoseconds of one call of a framebuffer operation */
+template<typename Operation>
+static long Nanoseconds(Operation operation) {
+	const int calls = 1000000;
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < calls; i++) {
+		operation(i);
+	}
+	return static_cast<long>(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 4) {
+		std::cerr << "Usage: " << argv[0] << " <Rom> [Instructions] [Runs]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	const char* romFilename = argv[1];
+	long instructions = argc > 2 ? std::stol(argv[2]) : 20000000; //instructions per run
+	int runs = argc > 3 ? std::stoi(argv[3]) : 5; //best of this many runs is reported
+
+	double best = 0;
+
+	for (int run = 0; run < runs; run++) {
+		Chip8 emulator;
+		if (!emulator.loadROM(romFilename)) {
+			std::exit(2);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (long i = 0; i < instructions; i++) {
+			if ((i & 0xFFFF) == 0) { //press and release keys now and then so input loops make progress
+				emulator.keypad[(i >> 16) & 0xF] ^= 1;
+			}
+			emulator.Cycle();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double ips = instructions / seconds;
+		if (ips > best) {
+			best = ips;
+		}
+	}
+
+	std::cout << ENGINE_NAME << " " << romFilename << " " << static_cast<long>(best) << " instructions/s\n";
+
+	uint64_t rows[VIDEO_HEIGHT] = {}, other[VIDEO_HEIGHT] = {};
+	static uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+	const uint8_t sprite[15] = {0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70, 0xF0, 0x10, 0xF0, 0x80, 0xF0};
+	volatile uint64_t sink = 0; //keeps the results alive
+
+	long clear = Nanoseconds([&](int) { videoKernels->clear(rows); sink = rows[0]; });
+	long blit = Nanoseconds([&](int i) { sink = videoKernels->blit(rows + (i & 15), sprite, 15, i & 63, i & 64); });
+	long expand = Nanoseconds([&](int i) { rows[i & 31] ^= i; ExpandVideo(rows, {0, 0, VIDEO_WIDTH, VIDEO_HEIGHT}, MONOCHROME, pixels, sizeof(pixels[0]) * VIDEO_WIDTH); });
+	long hash = Nanoseconds([&](int i) { rows[i & 31] ^= i; sink = videoKernels->hash(rows); });
+	long equal = Nanoseconds([&](int i) { rows[i & 31] ^= i; sink = videoKernels->equal(rows, other); });
+
+	std::cout << "kernels " << videoKernels->name << ": clear " << clear << " ns, blit " << blit << " ns, expand " << expand
+		<< " ns, hash " << hash << " ns, equal " << equal << " ns\n";
+
+	std::unique_ptr<Chip8> machine(new Chip8());
+	MachineState snapshot;
+	if (!machine->loadROM(romFilename)) {
+		std::exit(2);
+	}
+	machine->RunCycles(100000);
+
+	long save = Nanoseconds([&](int) { machine->SaveState(snapshot); sink = snapshot.cycles; });
+	long restore = Nanoseconds([&](int) { machine->RestoreState(snapshot); sink = machine->Cycles(); });
+
+	std::cout << "snapshot " << sizeof(MachineState) << " bytes: save " << save << " ns, restore " << restore << " ns\n";
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+//
+// Headless runner: runs a ROM for a number of frames without a window, then dumps the framebuffer and its hash (the
+// random numbers come from a fixed seed, so runs can be compared).
+//
+
+#include "Chip8.h"
+#include "Threaded.h"
+#include "Trace.h"
+#include "Video.h"
+#include <memory>
+#if CHIP8_JIT
+#include "Jit.h"
+#endif
+
+int main(int argc, char** argv) {
+	if (argc < 3 || argc > 4) {
+		std::cerr << "Usage: " << argv[0] << " <Rom> <Frames> [Dump]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	const char* romFilename = argv[1];
+	long frames = std::stol(argv[2]); //frames to run before dumping
+	const char* dumpFilename = argc > 3 ? argv[3] : nullptr; //framebuffer goes to stdout when no file is given
+
+	Chip8 emulator;
+	Threaded threaded(emulator);
+#if CHIP8_JIT
+	Jit jit(emulator);
+#endif
+	// CHIP8_TRACE=<file> keeps a binary trace of the last instructions and writes it on an invalid opcode,
+	// CHIP8_TRACE_ALL=1 streams every instruction to the file (see Trace.h)
+	std::unique_ptr<Tracer> tracer;
+	if (char const* traceFilename = std::getenv("CHIP8_TRACE")) {
+		tracer.reset(new Tracer(emulator, traceFilename, EnvironmentFlag("CHIP8_TRACE_ALL")));
+	}
+	if (EnvironmentFlag("CHIP8_WRAP")) { //CHIP8_WRAP=1 wraps sprites around the screen edges instead of clipping them
+		emulator.SetSpriteWrap(true);
+	}
+	if (!emulator.loadROM(romFilename)) {
+		std::exit(2);
+	}
+
+	// Cxkk is seeded with CHIP8_SEED=<n> (0 when not given), so the hash only changes when the program does
+	char const* seedText = std::getenv("CHIP8_SEED");
+	uint32_t seed = seedText ? std::stoul(seedText) : 0;
+	emulator.Seed(seed);
+
+	long frame = 0;
+	RunResult result = RunResult::FrameComplete;
+	while (frame < frames) {
+		result = emulator.RunFrame();
+		if (result == RunResult::FrameComplete) {
+			++frame;
+		}
+		else if (result == RunResult::InvalidOpcode) {
+			break;
+		}
+		// nobody presses keys here, so a frame waiting in Fx0A idles to its end
+	}
+
+	std::ofstream file;
+	if (dumpFilename) {
+		file.open(dumpFilename);
+		if (!file) {
+			std::cerr << "Could not open " << dumpFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	std::ostream& out = dumpFilename ? file : std::cout;
+
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; row++) {
+		for (unsigned int column = 0; column < VIDEO_WIDTH; column++) {
+			out << ((emulator.video[row] >> (63u - column)) & 1u ? '#' : '.');
+		}
+		out << "\n";
+	}
+
+	std::cout << "frames " << frame << " seed " << seed << " hash " << std::hex << videoKernels->hash(emulator.video)
+		<< std::dec << (result == RunResult::InvalidOpcode ? " (stopped at an invalid opcode)" : "") << "\n";
+
+	std::cout << "skipped " << emulator.SkippedCycles() << " busy-wait cycles\n";
+
+	return result == RunResult::InvalidOpcode ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,54 +1,187 @@
 
-#include "Classes.h"
+#include "Chip8.h"
+#include "Platform.h"
+#include "Log.h"
+#include "Movie.h"
+#include "Rewind.h"
+#include "Threaded.h"
+#include "Trace.h"
+#include <cstdio>
+#include <memory>
+#include <thread>
+#if CHIP8_JIT
+#include "Jit.h"
+#endif
+
+const int MAX_FRAME_SKIP = 5; //frames emulated without presenting when the host falls behind, before giving up on catching up
+const size_t REWIND_MB = 4; //default memory for the rewind history (a few minutes of a typical game at ~200 bytes a frame)
+
+/*
+	Sleeps until a deadline on the steady clock. OS sleeps can overshoot by a millisecond or two, so the last stretch
+	is spent yielding in a loop instead.
+*/
+static void SleepUntil(std::chrono::steady_clock::time_point deadline) {
+	const auto spin = std::chrono::milliseconds(2);
+	auto now = std::chrono::steady_clock::now();
+
+	if (deadline - now > spin) {
+		std::this_thread::sleep_for(deadline - now - spin);
+	}
+	while (std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::yield();
+	}
+}
 
 int main(int argc, char** argv) {
     /* 
         This function will: 
-            - Call Chip8::Cycle() continuously until program is terminated 
+            - Run one 60 Hz frame of instructions with Chip8::RunFrame() per host frame until program is terminated 
             - Handle inputs
-            - Render with SDL
+            - Render with SDL once per frame
     */
 
 	if (argc != 4) {
 		//std::cerr standared output stream for errors 
-		std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <Rom>\n";
+		std::cerr << "Usage: " << argv[0] << " <Scale> <InstructionsPerSecond> <Rom>\n";
 		std::exit(EXIT_FAILURE);
 	}
 
     //std::stoi --> interprets a signed integer value in the string argv[x]
     int videoScale = std::stoi(argv[1]); // amount video needs to be scaled by (integer scale factor)
-	int cycleDelay = std::stoi(argv[2]); //Time we want to wait between calling Chip8::Cycle()
+	int instructionsPerSecond = std::stoi(argv[2]); //emulated speed (any value, frames hold a fractional number of instructions)
 	const char* romFilename = argv[3]; //romfile that continas instructions for Chip8 emulator 
    
     Platform platform("Chip8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT); //creates platform object
 
 	Chip8 emulator; //creates Chip8 object 
-	emulator.loadROM(romFilename); //loads the ROM files so instructions are in memory
+	Threaded threaded(emulator); //runs the batches as pre-decoded blocks
+#if CHIP8_JIT
+	Jit jit(emulator); //compiles hot blocks to x86-64 (preferred over the threaded engine)
+#endif
+	// CHIP8_TRACE=<file> keeps a binary trace of the last instructions and writes it on an invalid opcode,
+	// CHIP8_TRACE_ALL=1 streams every instruction to the file (see Trace.h)
+	std::unique_ptr<Tracer> tracer;
+	if (char const* traceFilename = std::getenv("CHIP8_TRACE")) {
+		tracer.reset(new Tracer(emulator, traceFilename, EnvironmentFlag("CHIP8_TRACE_ALL")));
+	}
+	if (EnvironmentFlag("CHIP8_WRAP")) { //CHIP8_WRAP=1 wraps sprites around the screen edges instead of clipping them
+		emulator.SetSpriteWrap(true);
+	}
+	if (!emulator.loadROM(romFilename)) { //loads the ROM files so instructions are in memory
+		std::exit(2);
+	}
+	emulator.SetSpeed(instructionsPerSecond > 0 ? instructionsPerSecond : 1);
+
+	// deterministic mode: CHIP8_SEED=<n> seeds Cxkk so a session can be played again exactly, and CHIP8_RECORD=<file>
+	// records its key presses as a movie (seeded from the clock unless CHIP8_SEED is given, see Movie.h)
+	char const* seedText = std::getenv("CHIP8_SEED");
+	char const* movieFilename = std::getenv("CHIP8_RECORD");
+	std::unique_ptr<MovieRecorder> recorder;
+	if (seedText || movieFilename) {
+		uint32_t seed = seedText ? std::stoul(seedText) : uint32_t(std::chrono::system_clock::now().time_since_epoch().count());
+		emulator.Seed(seed);
+		LOG_INFO("Seed " << seed);
+		if (movieFilename) {
+			recorder.reset(new MovieRecorder(seed));
+		}
+	}
+
+	// CHIP8_PALETTE=<off>,<on> picks the colours as RGBA8888 hex words, e.g. 000000FF,33FF66FF
+	if (char const* colours = std::getenv("CHIP8_PALETTE")) {
+		unsigned int off, on;
+		if (std::sscanf(colours, "%x,%x", &off, &on) == 2) {
+			platform.setPalette({off, on});
+		}
+		else {
+			LOG_WARN("CHIP8_PALETTE should be <off>,<on> in hex, using black and white");
+		}
+	}
+
+	// holding Backspace steps back a frame per frame, CHIP8_REWIND=<MB> sets the memory the history may use
+	char const* rewindSize = std::getenv("CHIP8_REWIND");
+	Rewind history((rewindSize ? std::stoul(rewindSize) : REWIND_MB) << 20u);
+	history.Push(emulator); //the start of the program
+
+	// runs one frame of emulated time and records it, false if the program hit an invalid opcode
+	auto runFrame = [&emulator, &history, &recorder]() {
+		if (recorder) {
+			recorder->Frame(emulator); //the keys this frame runs with
+		}
 
-	int videoPitch = sizeof(emulator.video[0]) * VIDEO_WIDTH; //resizes the video
+		RunResult result;
+		do {
+			result = emulator.RunFrame(); //picks the frame up again after an Fx0A wait
+		} while (result == RunResult::WaitingForKey);
 
-	auto lastCycleTime = std::chrono::high_resolution_clock::now(); //gets current time (this is also the reference time)
+		if (result == RunResult::InvalidOpcode) {
+			return false;
+		}
+		history.Push(emulator);
+		return true;
+	};
+
+	const auto frameTime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / 60));
+	auto nextFrame = std::chrono::steady_clock::now() + frameTime; //when the current frame should be on screen
+	uint64_t frames = 0, skipped = 0;
 	bool quit = false;
 
-	std::cerr << "Starting Loop\n";
+	LOG_INFO("Starting Loop");
 
 	while (!quit) {
 		quit = platform.processInput(emulator.keypad); //calls method to get input from keypad (passes through Chip8 keyboard)
 
-		auto currentTime = std::chrono::high_resolution_clock::now(); //gets current time
-		float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count(); // gets time elapsed between currentTime and lastCycleTime
-		// std::cerr << "Delay: " << dt << "\n";
-		if (dt > cycleDelay) { //if time between calling Chip8::Cycle() is adequate, then the method can be called again
-			//std::cerr << "Refreshing screen\n";
-			lastCycleTime = currentTime; //current time becomes the reference time 
+		if (platform.rewinding) {
+			uint8_t held[16]; //the keys held now, not the ones saved with the frame
+			memcpy(held, emulator.keypad, sizeof(held));
+			if (history.StepBack(emulator) && recorder) { //stays on the oldest frame kept once the history runs out
+				recorder->StepBack();
+			}
+			memcpy(emulator.keypad, held, sizeof(held));
+		}
+		else if (!runFrame()) {
+			break;
+		}
 
-			emulator.Cycle(); //runs cycle of Chip8 to execute instruction from the keypad
+		// behind schedule: emulate the frames that are already overdue without drawing them
+		auto now = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < MAX_FRAME_SKIP && !platform.rewinding && now > nextFrame + frameTime; frame++) {
+			if (!runFrame()) {
+				quit = true;
+				break;
+			}
+			nextFrame += frameTime;
+			++skipped;
+		}
+		if (now > nextFrame + frameTime) { //still behind after skipping, drop the backlog instead of racing to catch up
+			nextFrame = now;
+		}
 
-			platform.update(emulator.video, videoPitch); //updates the window
+		if (emulator.WaitingForKey()) { //Fx0A: nothing to emulate until a key is pressed, so sleep in the event queue instead
+			for (auto now = std::chrono::steady_clock::now(); !quit && now < nextFrame; now = std::chrono::steady_clock::now()) {
+				int wait = int(std::chrono::duration_cast<std::chrono::milliseconds>(nextFrame - now).count());
+				if (wait <= 0) {
+					break;
+				}
+				quit = platform.processInput(emulator.keypad, wait);
+			}
+		}
+		else {
+			SleepUntil(nextFrame);
 		}
+		platform.update(emulator.video, emulator.FrameVersion(), emulator.TakeDirtyRect()); //updates the window if the video changed
+		++frames;
+		nextFrame += frameTime;
 	}
-	
-	std::cerr << "Program terminated!\n";
+
+	if (recorder) {
+		recorder->Save(movieFilename, emulator);
+	}
+
+	LOG_INFO("Ran " << frames << " frames, skipped " << skipped << " to catch up");
+	LOG_INFO("Presented " << platform.presentsDone << " frames, " << platform.presentsSkipped << " left out unchanged");
+	LOG_INFO("Fast-forwarded " << emulator.SkippedCycles() << " busy-wait cycles");
+	LOG_INFO("Rewind history holds " << history.Frames() << " frames in " << history.Bytes() << " bytes");
+	LOG_INFO("Program terminated!");
 
 	return 0;
 }
\ No newline at end of file
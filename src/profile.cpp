@@ -0,0 +1,118 @@
+//
+// N-gram profiler: runs a ROM through Chip8::Cycle() and prints the most executed instruction sequences.
+// Used to pick the superinstructions fused by the threaded engine (see Threaded.h).
+//
+
+#include "Chip8.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+class Profiler {
+private:
+	Chip8& chip;
+
+	//instruction pattern an opcode belongs to (same split as Chip8::DispatchSwitch())
+	static std::string Pattern(uint16_t opcode) {
+		static const char* const family8[16] = {
+			"8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "", "", "", "", "", "", "8xyE", ""
+		};
+		static const char* const families[16] = {
+			"", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "6xkk", "7xkk", "", "9xy0", "Annn", "Bnnn", "Cxkk", "Dxyn", "", ""
+		};
+		char name[8];
+
+		switch (opcode >> 12u) {
+			case 0x0:
+				return opcode == 0x00E0 ? "00E0" : opcode == 0x00EE ? "00EE" : "????";
+			case 0x8:
+				return *family8[opcode & 0xFu] ? family8[opcode & 0xFu] : "????";
+			case 0xE:
+				return (opcode & 0xFFu) == 0x9E ? "Ex9E" : (opcode & 0xFFu) == 0xA1 ? "ExA1" : "????";
+			case 0xF:
+				std::snprintf(name, sizeof(name), "Fx%02X", opcode & 0xFFu);
+				return name;
+			default:
+				return families[opcode >> 12u];
+		}
+	}
+
+public:
+	explicit Profiler(Chip8& c) : chip(c) {}
+
+	/*
+		Counts every run of 1 to "length" instructions that executed back to back at consecutive addresses (the
+		sequences a fusion pass can merge), then prints the "top" most frequent ones for each length.
+	*/
+	void Run(long instructions, unsigned int length, unsigned int top) {
+		std::vector<std::map<std::string, uint64_t>> counts(length + 1);
+		std::vector<std::string> window; //patterns of the straight-line run that ends at the current instruction
+		uint16_t expected = 0xFFFF; //address of the next instruction if execution continues in a straight line
+
+		for (long i = 0; i < instructions; i++) {
+			if ((i & 0xFFFF) == 0) { //press and release keys now and then so input loops make progress
+				chip.keypad[(i >> 16) & 0xF] ^= 1;
+			}
+
+			uint16_t pc = chip.pc;
+			if (pc != expected) {
+				window.clear();
+			}
+			if (window.size() == length) {
+				window.erase(window.begin());
+			}
+			window.push_back(pc + 1u < MEMSIZE ? Pattern((chip.memory[pc] << 8u) | chip.memory[pc + 1]) : "????");
+
+			std::string gram;
+			for (size_t n = 1; n <= window.size(); n++) {
+				gram = n == 1 ? window[window.size() - 1] : window[window.size() - n] + " " + gram;
+				++counts[n][gram];
+			}
+
+			chip.Cycle();
+			expected = uint16_t(pc + 2);
+		}
+
+		for (unsigned int n = 1; n <= length; n++) {
+			std::vector<std::pair<uint64_t, std::string>> sorted;
+			for (auto const& entry : counts[n]) {
+				sorted.emplace_back(entry.second, entry.first);
+			}
+			std::sort(sorted.rbegin(), sorted.rend());
+
+			std::cout << n << "-grams:\n";
+			for (size_t rank = 0; rank < sorted.size() && rank < top; rank++) {
+				std::printf("  %-24s %12llu  %5.2f%%\n", sorted[rank].second.c_str(),
+					static_cast<unsigned long long>(sorted[rank].first), 100.0 * sorted[rank].first / instructions);
+			}
+		}
+	}
+};
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 5) {
+		std::cerr << "Usage: " << argv[0] << " <Rom> [Instructions] [Length] [Top]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	const char* romFilename = argv[1];
+	long instructions = argc > 2 ? std::stol(argv[2]) : 1000000; //instructions to profile
+	unsigned int length = argc > 3 ? std::stoul(argv[3]) : 3; //longest sequence counted
+	unsigned int top = argc > 4 ? std::stoul(argv[4]) : 10; //sequences printed per length
+	if (length == 0) {
+		std::cerr << "Length must be at least 1\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	Chip8 emulator;
+	if (!emulator.loadROM(romFilename)) {
+		std::exit(2);
+	}
+
+	Profiler profiler(emulator);
+	profiler.Run(instructions, length, top);
+
+	return 0;
+}
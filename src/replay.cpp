@@ -0,0 +1,67 @@
+//
+// Movie replay: plays a recorded session (CHIP8_RECORD=<file> in the frontend) without a window, as fast as it runs,
+// and checks that it ends where the recording did. Starting at a frame seeks through the keyframe index first.
+//
+
+#include "Chip8.h"
+#include "Movie.h"
+#include "Threaded.h"
+#include "Video.h"
+#include <memory>
+#if CHIP8_JIT
+#include "Jit.h"
+#endif
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 4) {
+		std::cerr << "Usage: " << argv[0] << " <Movie> [StartFrame] [Frames]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	MoviePlayer movie;
+	if (!movie.Open(argv[1])) {
+		std::exit(EXIT_FAILURE);
+	}
+	uint64_t start = argc > 2 ? std::stoull(argv[2]) : 0;
+	uint64_t frames = argc > 3 ? std::stoull(argv[3]) : movie.Frames(); //frames to play from the start frame
+
+	std::unique_ptr<Chip8> emulator(new Chip8());
+	Threaded threaded(*emulator);
+#if CHIP8_JIT
+	Jit jit(*emulator);
+#endif
+
+	auto seekStart = std::chrono::steady_clock::now();
+	if (!movie.Seek(*emulator, start)) {
+		std::cerr << "Could not seek to frame " << start << " of " << movie.Frames() << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+	double seekSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - seekStart).count();
+
+	uint64_t startCycles = emulator->Cycles();
+	RunResult result = RunResult::FrameComplete;
+	auto playStart = std::chrono::steady_clock::now();
+	for (uint64_t frame = 0; frame < frames && result == RunResult::FrameComplete; frame++) {
+		result = movie.Step(*emulator);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - playStart).count();
+
+	uint64_t cycles = emulator->Cycles() - startCycles;
+	std::cout << "frames " << movie.Frame() << " of " << movie.Frames() << " (seed " << movie.Seed() << "), cycles "
+		<< emulator->Cycles() << ", hash " << std::hex << videoKernels->hash(emulator->video) << std::dec
+		<< (result == RunResult::InvalidOpcode ? " (stopped at an invalid opcode)" : "") << "\n";
+	std::cout << "seek " << seekSeconds * 1000 << " ms, played " << seconds << " s, "
+		<< static_cast<long>(seconds > 0 ? cycles / seconds : 0) << " instructions/s\n";
+
+	bool ok = movie.Desyncs() == 0;
+	if (!ok) {
+		std::cout << movie.Desyncs() << " key changes came at another cycle than recorded\n";
+	}
+	if (movie.Frame() == movie.Frames()) {
+		bool matches = movie.Matches(*emulator);
+		std::cout << (matches ? "ends where the recording did\n" : "ends somewhere else than the recording\n");
+		ok = ok && matches;
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+//
+// Seed sweep: runs one ROM under many seeds with the lockstep engine (32 instances at a time) and prints the final
+// display hash and cycle count of every seed. Each seed also gets its own key presses, a key picked from the seed is
+// held for 8 frames out of every 16, so input loops take different paths too.
+// "verify" reruns every seed on its own through Chip8 and fails if any result differs.
+//
+
+#include "Chip8.h"
+#include "Lockstep.h"
+#include "Video.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+const unsigned int LANES = 32;
+
+struct Result {
+	long frames; //frames completed
+	uint64_t cycles;
+	uint64_t hash; //VideoKernels::hash of the final display
+};
+
+/* Keypad of a seed at the start of a frame */
+static void ScriptKeys(uint32_t seed, long frame, uint8_t* keypad) {
+	uint32_t h = seed * 0x9E3779B9u ^ uint32_t(frame / 16) * 0x85EBCA6Bu;
+	h ^= h >> 15u;
+
+	memset(keypad, 0, 16);
+	keypad[h & 0xFu] = (frame / 8) & 1;
+}
+
+/* Seeds first .. first + LANES - 1 side by side */
+static void RunGroup(char const* romFilename, long frames, uint32_t ips, uint32_t first, Result* results, double& occupancy) {
+	std::unique_ptr<Lockstep<LANES>> lanes(new Lockstep<LANES>());
+	if (!lanes->loadROM(romFilename)) {
+		std::exit(2);
+	}
+	lanes->SetSpeed(ips);
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		lanes->Seed(l, first + l);
+		results[l] = {0, 0, 0};
+	}
+
+	for (long frame = 0; frame < frames; frame++) {
+		for (unsigned int l = 0; l < LANES; l++) {
+			ScriptKeys(first + l, frame, lanes->keypad[l]);
+		}
+		lanes->RunFrame();
+		for (unsigned int l = 0; l < LANES; l++) {
+			results[l].frames += !lanes->Stopped(l);
+		}
+	}
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		results[l].cycles = lanes->Cycles(l);
+		results[l].hash = videoKernels->hash(lanes->video[l]);
+	}
+	occupancy = lanes->Occupancy();
+}
+
+/* One seed through Chip8, driven the way the batch runner drives a job */
+static Result RunAlone(char const* romFilename, long frames, uint32_t ips, uint32_t seed) {
+	std::unique_ptr<Chip8> chip(new Chip8());
+	Result result = {0, 0, 0};
+
+	chip->Seed(seed);
+	if (!chip->loadROM(romFilename)) {
+		std::exit(2);
+	}
+	chip->SetSpeed(ips);
+
+	while (result.frames < frames) {
+		ScriptKeys(seed, result.frames, chip->keypad);
+
+		RunResult run;
+		do {
+			run = chip->RunFrame();
+		} while (run == RunResult::WaitingForKey);
+
+		if (run == RunResult::InvalidOpcode) {
+			break;
+		}
+		++result.frames;
+	}
+
+	result.cycles = chip->Cycles();
+	result.hash = videoKernels->hash(chip->video);
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4 || argc > 6) {
+		std::cerr << "Usage: " << argv[0] << " <Rom> <Frames> <Instances> [InstructionsPerSecond] [verify]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	const char* romFilename = argv[1];
+	long frames = std::stol(argv[2]);
+	uint32_t instances = std::stoul(argv[3]); //seeds 0 .. instances - 1
+	uint32_t ips = argc > 4 ? std::stoul(argv[4]) : 600;
+	bool verify = argc > 5 && std::string(argv[5]) == "verify";
+
+	std::vector<Result> results((instances + LANES - 1) / LANES * LANES);
+	double occupancy = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t first = 0; first < instances; first += LANES) {
+		double groupOccupancy;
+		RunGroup(romFilename, frames, ips, first, &results[first], groupOccupancy);
+		occupancy += groupOccupancy;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::printf("seed,frames,cycles,hash\n");
+	for (uint32_t seed = 0; seed < instances; seed++) {
+		std::printf("%u,%ld,%llu,%016llx\n", seed, results[seed].frames, static_cast<unsigned long long>(results[seed].cycles),
+			static_cast<unsigned long long>(results[seed].hash));
+	}
+	std::cerr << instances << " instances in " << seconds << " s, " << occupancy / (results.size() / LANES)
+		<< " of " << LANES << " lanes busy on average\n";
+
+	if (verify) {
+		unsigned int mismatches = 0;
+
+		start = std::chrono::steady_clock::now();
+		for (uint32_t seed = 0; seed < instances; seed++) {
+			Result alone = RunAlone(romFilename, frames, ips, seed);
+			if (alone.frames != results[seed].frames || alone.cycles != results[seed].cycles || alone.hash != results[seed].hash) {
+				std::cerr << "seed " << seed << " differs: Chip8 ran " << alone.frames << " frames, " << alone.cycles
+					<< " cycles, hash " << std::hex << alone.hash << std::dec << "\n";
+				++mismatches;
+			}
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cerr << "Chip8 alone took " << seconds << " s, " << mismatches << " mismatches\n";
+		if (mismatches) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return 0;
+}
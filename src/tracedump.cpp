@@ -0,0 +1,55 @@
+//
+// Turns a binary instruction trace (see Trace.h) into text, one instruction per line.
+//
+
+#include "Trace.h"
+#include <vector>
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " <Trace> [Last]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	const char* traceFilename = argv[1];
+	unsigned long last = argc > 2 ? std::stoul(argv[2]) : 0; //only print the last records (0 prints all of them)
+
+	FILE* file = std::fopen(traceFilename, "rb");
+	if (!file) {
+		std::cerr << "Could not open " << traceFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	char magic[sizeof(TRACE_MAGIC)];
+	if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+		std::cerr << traceFilename << " is not an instruction trace\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	std::vector<TraceRecord> records;
+	TraceRecord record;
+	while (std::fread(&record, sizeof(record), 1, file) == 1) {
+		records.push_back(record);
+	}
+	std::fclose(file);
+
+	size_t first = last && last < records.size() ? records.size() - last : 0;
+	for (size_t i = first; i < records.size(); i++) {
+		TraceRecord const& r = records[i];
+
+		if (r.pc == 0xFFFF) {
+			uint64_t lost;
+			std::memcpy(&lost, r.V, sizeof(lost));
+			std::printf("... %llu records lost ...\n", static_cast<unsigned long long>(lost));
+			continue;
+		}
+
+		std::printf("%03X  %04X  I=%03X SP=%X DT=%02X  V:", r.pc, r.opcode, r.I, r.sp, r.delayTimer);
+		for (int v = 0; v < 16; v++) {
+			std::printf(" %02X", r.V[v]);
+		}
+		std::printf("\n");
+	}
+
+	return 0;
+}
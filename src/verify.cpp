@@ -0,0 +1,528 @@
+//
+// Differential check: runs a ROM through every engine of this build and compares each frame with the same machine
+// stepped by Chip8::Cycle() alone (the reference). Also checks that saved states, rewinding and movies put a machine
+// back exactly where it was. Keys are pressed from a script, so input loops and Fx0A waits are covered too.
+// The last line holds the cycle count and display hash of the reference, which match across dispatch engines when
+// they agree (ctest compares every engine with CHIP8_DISPATCH_SWITCH this way).
+//
+
+#include "Chip8.h"
+#include "Lockstep.h"
+#include "Movie.h"
+#include "Rewind.h"
+#include "Threaded.h"
+#include "Video.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if CHIP8_JIT
+#include "Jit.h"
+#endif
+
+#if CHIP8_DISPATCH == CHIP8_DISPATCH_SWITCH
+#define ENGINE_NAME "switch"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_TABLE
+#define ENGINE_NAME "table"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_GOTO
+#define ENGINE_NAME "goto"
+#elif CHIP8_DISPATCH == CHIP8_DISPATCH_CACHED
+#define ENGINE_NAME "cached"
+#else
+#define ENGINE_NAME "constexpr"
+#endif
+
+const unsigned int LANES = 8; //lockstep lanes, each with its own seed and keys
+const long SAVE_INTERVAL = 97; //frames between state round trips
+const long REWIND_INTERVAL = 101; //frames between rewinds
+const size_t REWIND_FRAMES = 45; //frames gone back at each rewind
+
+struct Run {
+	char const* rom;
+	long frames;
+	uint32_t ips;
+	uint32_t seed;
+};
+
+/* Keypad of a seed at the start of a frame: a key picked from the seed is held for 8 frames out of every 16 (as sweep) */
+static void ScriptKeys(uint32_t seed, long frame, uint8_t* keypad) {
+	uint32_t h = seed * 0x9E3779B9u ^ uint32_t(frame / 16) * 0x85EBCA6Bu;
+	h ^= h >> 15u;
+
+	memset(keypad, 0, 16);
+	keypad[h & 0xFu] = (frame / 8) & 1;
+}
+
+/* Machine with the ROM loaded, seeded and at speed */
+static std::unique_ptr<Chip8> Boot(Run const& run) {
+	std::unique_ptr<Chip8> chip(new Chip8());
+	if (!chip->loadROM(run.rom)) {
+		std::exit(2);
+	}
+	chip->Seed(run.seed);
+	chip->SetSpeed(run.ips);
+	return chip;
+}
+
+/* Runs a frame the way the hosts do: keys set first, then RunFrame() until the frame is done */
+static RunResult PlayFrame(Chip8& chip, uint32_t seed, long frame) {
+	ScriptKeys(seed, frame, chip.keypad);
+
+	RunResult result;
+	do {
+		result = chip.RunFrame();
+	} while (result == RunResult::WaitingForKey);
+	return result;
+}
+
+/* The same machine run one Chip8::Cycle() at a time, with the frame ends worked out from the speed */
+class Reference {
+private:
+	std::unique_ptr<Chip8> chip;
+	uint32_t seed;
+	uint32_t ips;
+	long frames = 0; //frames run
+
+public:
+	Reference(Run const& run, uint32_t s) : chip(Boot({run.rom, run.frames, run.ips, s})), seed(s), ips(run.ips) {}
+
+	//the machine at the end of a frame (frames only go forward)
+	Chip8 const& At(long frame) {
+		while (frames < frame) {
+			ScriptKeys(seed, frames, chip->keypad);
+			++frames;
+
+			uint64_t end = (uint64_t(frames) * ips + 59u) / 60u; //first instruction count of the next tick
+			while (chip->Cycles() < end) {
+				chip->Cycle();
+			}
+		}
+		return *chip;
+	}
+
+	//the machine part way into the frame after "frame" (where an engine stopped at an invalid opcode)
+	Chip8 const& Until(long frame, uint64_t cycles) {
+		At(frame);
+		ScriptKeys(seed, frames, chip->keypad);
+		while (chip->Cycles() < cycles) {
+			chip->Cycle();
+		}
+		return *chip;
+	}
+};
+
+/*
+	First part of two machines that differs, nullptr if they are the same. The opcode, skipped cycles, frame version
+	and dirty rectangle depend on how a machine was driven rather than on what it ran, so they are left out.
+*/
+static char const* Difference(Chip8 const& a, Chip8 const& b) {
+	MachineState x, y;
+	a.SaveState(x);
+	b.SaveState(y);
+
+#define VERIFY_FIELD(field) if (memcmp(&x.field, &y.field, sizeof(x.field)) != 0) { return #field; }
+	VERIFY_FIELD(cycles)
+	VERIFY_FIELD(video)
+	VERIFY_FIELD(pc)
+	VERIFY_FIELD(V)
+	VERIFY_FIELD(I)
+	VERIFY_FIELD(sp)
+	VERIFY_FIELD(stack)
+	VERIFY_FIELD(delayTimer)
+	VERIFY_FIELD(delaySetAt)
+	VERIFY_FIELD(soundTimer)
+	VERIFY_FIELD(soundSetAt)
+	VERIFY_FIELD(random)
+	VERIFY_FIELD(waitingForKey)
+	VERIFY_FIELD(waitRegister)
+	VERIFY_FIELD(keypad)
+	VERIFY_FIELD(memory)
+	VERIFY_FIELD(instructionsPerSecond)
+	VERIFY_FIELD(wrapSprites)
+#undef VERIFY_FIELD
+	return nullptr;
+}
+
+/* Prints where a check first went wrong */
+static bool Mismatch(char const* check, long frame, char const* field, uint64_t cycles, uint64_t hash, uint64_t expectedCycles,
+		uint64_t expectedHash) {
+	std::printf("%s: frame %ld differs in %s (cycles %llu, hash %016llx, Chip8::Cycle() has %llu, %016llx)\n", check, frame,
+		field, static_cast<unsigned long long>(cycles), static_cast<unsigned long long>(hash),
+		static_cast<unsigned long long>(expectedCycles), static_cast<unsigned long long>(expectedHash));
+	return false;
+}
+
+/* Compares a machine with the reference, true if they agree */
+static bool Same(char const* check, long frame, Chip8 const& chip, Chip8 const& reference) {
+	char const* field = Difference(chip, reference);
+	if (field) {
+		return Mismatch(check, frame, field, chip.Cycles(), videoKernels->hash(chip.video), reference.Cycles(),
+			videoKernels->hash(reference.video));
+	}
+	return true;
+}
+
+/* Ends a check that went to the end */
+static bool Passed(char const* check, char const* detail = "") {
+	std::printf("%s: ok%s\n", check, detail);
+	return true;
+}
+
+/* Nothing attached: RunFrame() steps Chip8::Cycle() itself and fast-forwards busy-wait loops */
+struct Interpreter {
+	explicit Interpreter(Chip8&) {}
+};
+
+/* Plays every frame with an engine attached and compares each one with the reference */
+template<typename Engine>
+static bool CheckEngine(char const* check, Run const& run) {
+	std::unique_ptr<Chip8> chip = Boot(run);
+	Engine engine(*chip);
+	Reference reference(run, run.seed);
+
+	for (long frame = 0; frame < run.frames; frame++) {
+		if (PlayFrame(*chip, run.seed, frame) == RunResult::InvalidOpcode) {
+			return Same(check, frame + 1, *chip, reference.Until(frame, chip->Cycles())) && Passed(check, " (stopped at an invalid opcode)");
+		}
+		if (!Same(check, frame + 1, *chip, reference.At(frame + 1))) {
+			return false;
+		}
+	}
+	return Passed(check);
+}
+
+/* Every SAVE_INTERVAL frames the machine goes through the state format into a new Chip8 and carries on from there */
+static bool CheckState(Run const& run) {
+	std::unique_ptr<Chip8> chip = Boot(run);
+	std::unique_ptr<Threaded> threaded(new Threaded(*chip));
+	Reference reference(run, run.seed);
+
+	for (long frame = 0; frame < run.frames; frame++) {
+		if (frame % SAVE_INTERVAL == SAVE_INTERVAL - 1) {
+			std::vector<uint8_t> bytes = chip->SaveStateBytes();
+			std::unique_ptr<Chip8> loaded(new Chip8());
+			if (!loaded->LoadStateBytes(bytes.data(), bytes.size())) {
+				std::printf("state: frame %ld could not be loaded back\n", frame);
+				return false;
+			}
+			threaded.reset(new Threaded(*loaded));
+			chip = std::move(loaded);
+		}
+
+		if (PlayFrame(*chip, run.seed, frame) == RunResult::InvalidOpcode) {
+			return Same("state", frame + 1, *chip, reference.Until(frame, chip->Cycles())) && Passed("state", " (stopped at an invalid opcode)");
+		}
+		if (!Same("state", frame + 1, *chip, reference.At(frame + 1))) {
+			return false;
+		}
+	}
+	return Passed("state");
+}
+
+/* State file of a machine that was given a changed field (RestoreState() leaves the whole display dirty, "clean" takes it) */
+template<typename Change>
+static std::vector<uint8_t> ChangedState(Chip8 const& chip, Change change, bool clean = false) {
+	MachineState state;
+	chip.SaveState(state);
+	change(state);
+
+	std::unique_ptr<Chip8> changed(new Chip8());
+	changed->RestoreState(state);
+	if (clean) {
+		changed->TakeDirtyRect();
+	}
+	return changed->SaveStateBytes();
+}
+
+/* A state file with the nth byte where it differs from another one set to a value (for fields no machine can hold) */
+static std::vector<uint8_t> Corrupt(std::vector<uint8_t> state, std::vector<uint8_t> const& other, uint8_t value, unsigned int nth = 0) {
+	for (size_t b = 0; b < state.size(); b++) {
+		if (state[b] != other[b] && nth-- == 0) {
+			state[b] = value;
+			break;
+		}
+	}
+	return state;
+}
+
+/* States a machine could never be in (or cut short) are refused, and leave the machine they were loaded into alone */
+static bool CheckDamagedState(Run const& run) {
+	std::unique_ptr<Chip8> chip = Boot(run);
+	for (long frame = 0; frame < 60 && chip->RunFrame() != RunResult::InvalidOpcode; frame++) {
+	}
+	std::vector<uint8_t> good = chip->SaveStateBytes();
+
+	auto same = [](MachineState&) {};
+	std::vector<uint8_t> dirty = ChangedState(*chip, same); //dirty rectangle 0, 0, 64, 32
+	std::vector<uint8_t> clean = ChangedState(*chip, same, true); //dirty rectangle 0, 0, 0, 0
+	std::vector<uint8_t> wrapped = ChangedState(*chip, [](MachineState& s) { s.wrapSprites = !s.wrapSprites; });
+
+	std::vector<std::pair<char const*, std::vector<uint8_t>>> damaged;
+	damaged.emplace_back("sp", ChangedState(*chip, [](MachineState& s) { s.sp = 17; }));
+	damaged.emplace_back("waitRegister", ChangedState(*chip, [](MachineState& s) { s.waitRegister = 16; }));
+	damaged.emplace_back("instructionsPerSecond", ChangedState(*chip, [](MachineState& s) { s.instructionsPerSecond = 0; }));
+	damaged.emplace_back("cycleBase", ChangedState(*chip, [](MachineState& s) { s.cycleBase = s.cycles + 1; }));
+	damaged.emplace_back("dirty right", Corrupt(dirty, clean, VIDEO_WIDTH + 1)); //the two differ in right, then bottom
+	damaged.emplace_back("dirty bottom", Corrupt(dirty, clean, 0, 1)); //bottom 0, not below the top
+	damaged.emplace_back("wrapSprites", Corrupt(wrapped, dirty, 2));
+	damaged.emplace_back("length", std::vector<uint8_t>(good.begin(), good.end() - 1));
+
+	std::unique_ptr<Chip8> target = Boot(run);
+	std::vector<uint8_t> before = target->SaveStateBytes();
+	for (auto const& state : damaged) {
+		bool loaded = target->LoadStateBytes(state.second.data(), state.second.size());
+		if (loaded || target->SaveStateBytes() != before) {
+			std::printf("damaged state: a state with a bad %s was %s\n", state.first, loaded ? "loaded" : "refused, but the machine changed");
+			return false;
+		}
+	}
+	if (!target->LoadStateBytes(good.data(), good.size())) {
+		std::printf("damaged state: the undamaged state was refused\n");
+		return false;
+	}
+	return Passed("damaged state");
+}
+
+/*
+	Every REWIND_INTERVAL frames the machine goes back REWIND_FRAMES frames and plays them again. It runs with the
+	fastest engine attached, so going back to older memory also has to drop the code translated from the newer one.
+*/
+static bool CheckRewind(Run const& run) {
+	std::unique_ptr<Chip8> chip = Boot(run);
+	Threaded threaded(*chip);
+#if CHIP8_JIT
+	Jit jit(*chip);
+#endif
+	Rewind history(size_t(64) << 20, 30);
+	Reference reference(run, run.seed);
+
+	history.Push(*chip); //frame 0, nothing run yet
+	for (long frame = 0; frame < run.frames; frame++) {
+		if (PlayFrame(*chip, run.seed, frame) == RunResult::InvalidOpcode) {
+			return Passed("rewind", " (stopped at an invalid opcode)"); //the engine checks cover the stop itself
+		}
+		history.Push(*chip);
+
+		if (frame % REWIND_INTERVAL == REWIND_INTERVAL - 1 && history.Frames() > REWIND_FRAMES) {
+			reference = Reference(run, run.seed); //the reference only goes forward, so it starts over
+			if (!history.Seek(*chip, REWIND_FRAMES) || !Same("rewind", frame + 1 - long(REWIND_FRAMES), *chip,
+					reference.At(frame + 1 - long(REWIND_FRAMES)))) {
+				std::printf("rewind: going back %zu frames from frame %ld failed\n", REWIND_FRAMES, frame + 1);
+				return false;
+			}
+
+			for (long again = frame + 1 - long(REWIND_FRAMES); again <= frame; again++) {
+				PlayFrame(*chip, run.seed, again);
+				history.Push(*chip);
+			}
+		}
+
+		if (!Same("rewind", frame + 1, *chip, reference.At(frame + 1))) {
+			return false;
+		}
+	}
+	return Passed("rewind");
+}
+
+/* Whole file, empty if it can't be read */
+static std::vector<uint8_t> ReadFile(char const* filename) {
+	std::ifstream in(filename, std::ios::binary);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(char const* filename, std::vector<uint8_t> const& bytes) {
+	std::ofstream(filename, std::ios::binary).write(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+}
+
+/*
+	A movie whose first keyframe holds a state no machine can be in has to fail the seek and leave the machine alone,
+	and a cut off movie has to fail to open. The keyframe is found by its bytes: it is the booted machine, with the
+	keys of frame 0 (none) pressed.
+*/
+static bool CheckDamagedMovie(Run const& run, char const* filename, std::vector<uint8_t> const& movie) {
+	std::unique_ptr<Chip8> boot = Boot(run);
+	std::vector<uint8_t> keyframe = boot->SaveStateBytes();
+	auto at = std::search(movie.begin(), movie.end(), keyframe.begin(), keyframe.end());
+	if (at == movie.end()) {
+		std::printf("damaged movie: the first keyframe is not in the file\n");
+		return false;
+	}
+
+	std::vector<uint8_t> damaged(movie);
+	std::vector<uint8_t> bad = ChangedState(*boot, [](MachineState& s) { s.sp = 17; });
+	std::copy(bad.begin(), bad.end(), damaged.begin() + (at - movie.begin()));
+	WriteFile(filename, damaged);
+
+	MoviePlayer player;
+	std::unique_ptr<Chip8> chip(new Chip8());
+	std::vector<uint8_t> before = chip->SaveStateBytes();
+	if (!player.Open(filename) || player.Seek(*chip, 0) || chip->SaveStateBytes() != before) {
+		std::printf("damaged movie: a bad keyframe was not refused\n");
+		return false;
+	}
+
+	WriteFile(filename, std::vector<uint8_t>(movie.begin(), at + keyframe.size() / 2));
+	if (player.Open(filename)) {
+		std::printf("damaged movie: a movie cut off in a keyframe was opened\n");
+		return false;
+	}
+
+	WriteFile(filename, movie);
+	return Passed("damaged movie");
+}
+
+/* Records the run as a movie, then plays it back from the start and from a keyframe in the middle */
+static bool CheckMovie(Run const& run) {
+	char filename[] = "/tmp/chip8_verify_XXXXXX";
+	int fd = mkstemp(filename);
+	if (fd < 0) {
+		std::printf("movie: could not create a temporary file\n");
+		return false;
+	}
+	close(fd);
+
+	std::unique_ptr<Chip8> chip = Boot(run);
+	MovieRecorder recorder(run.seed, 120);
+	long frames = 0;
+	for (; frames < run.frames; frames++) {
+		ScriptKeys(run.seed, frames, chip->keypad);
+		recorder.Frame(*chip);
+
+		RunResult result;
+		do {
+			result = chip->RunFrame();
+		} while (result == RunResult::WaitingForKey);
+
+		if (result == RunResult::InvalidOpcode) {
+			++frames;
+			break;
+		}
+	}
+
+	MoviePlayer player;
+	bool saved = recorder.Save(filename, *chip) && player.Open(filename);
+	std::vector<uint8_t> file = ReadFile(filename);
+	if (!saved || !CheckDamagedMovie(run, filename, file)) {
+		std::remove(filename);
+		std::printf("movie: could not be written and read back\n");
+		return false;
+	}
+	std::remove(filename);
+
+	Reference reference(run, run.seed);
+	std::unique_ptr<Chip8> replay(new Chip8());
+	if (!player.Seek(*replay, 0)) {
+		std::printf("movie: could not seek to the start\n");
+		return false;
+	}
+	while (player.Step(*replay) == RunResult::FrameComplete) {
+		if (!Same("movie", long(player.Frame()), *replay, reference.At(long(player.Frame())))) {
+			return false;
+		}
+	}
+	if (player.Frame() != uint64_t(frames) || !player.Matches(*replay) || player.Desyncs()) {
+		std::printf("movie: played %llu of %ld frames, %llu desyncs, %s the recording\n",
+			static_cast<unsigned long long>(player.Frame()), frames, static_cast<unsigned long long>(player.Desyncs()),
+			player.Matches(*replay) ? "ends as" : "does not end as");
+		return false;
+	}
+
+	uint64_t middle = uint64_t(std::min(frames, frames / 2 + 7)); //between two keyframes, so the seek plays some frames
+	std::unique_ptr<Chip8> seeked(new Chip8());
+	Reference fromMiddle(run, run.seed);
+	if (!player.Seek(*seeked, middle) || !Same("movie", long(middle), *seeked, fromMiddle.At(long(middle)))) {
+		std::printf("movie: seeking to frame %llu failed\n", static_cast<unsigned long long>(middle));
+		return false;
+	}
+	while (player.Step(*seeked) == RunResult::FrameComplete) {
+	}
+	if (!player.Matches(*seeked)) {
+		std::printf("movie: playing on from frame %llu does not end as the recording\n", static_cast<unsigned long long>(middle));
+		return false;
+	}
+	return Passed("movie");
+}
+
+/* Lanes with seeds seed .. seed + LANES - 1, each compared with its own reference */
+static bool CheckLockstep(Run const& run) {
+	std::unique_ptr<Lockstep<LANES>> lanes(new Lockstep<LANES>());
+	if (!lanes->loadROM(run.rom)) {
+		std::exit(2);
+	}
+	lanes->SetSpeed(run.ips);
+
+	std::vector<std::unique_ptr<Reference>> references;
+	for (unsigned int l = 0; l < LANES; l++) {
+		lanes->Seed(l, run.seed + l);
+		references.emplace_back(new Reference(run, run.seed + l));
+	}
+
+	uint32_t checked = (1u << LANES) - 1; //lanes still compared (a lane that stopped is compared once)
+	for (long frame = 0; frame < run.frames && checked; frame++) {
+		for (unsigned int l = 0; l < LANES; l++) {
+			ScriptKeys(run.seed + l, frame, lanes->keypad[l]);
+		}
+		lanes->RunFrame();
+
+		for (unsigned int l = 0; l < LANES; l++) {
+			if (!(checked >> l & 1u)) {
+				continue;
+			}
+
+			Chip8 const& reference = lanes->Stopped(l) ? references[l]->Until(frame, lanes->Cycles(l)) : references[l]->At(frame + 1);
+			uint64_t hash = videoKernels->hash(lanes->video[l]);
+			if (lanes->Cycles(l) != reference.Cycles() || hash != videoKernels->hash(reference.video)) {
+				std::string check = "lockstep lane " + std::to_string(l);
+				return Mismatch(check.c_str(), frame + 1, "cycles or video", lanes->Cycles(l), hash, reference.Cycles(),
+					videoKernels->hash(reference.video));
+			}
+			if (lanes->Stopped(l)) {
+				checked &= ~(1u << l);
+			}
+		}
+	}
+	return Passed("lockstep");
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 5) {
+		std::cerr << "Usage: " << argv[0] << " <Rom> [Frames] [InstructionsPerSecond] [Seed]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	Run run;
+	run.rom = argv[1];
+	run.frames = argc > 2 ? std::stol(argv[2]) : 1800; //30 seconds of emulated time at 60 Hz
+	run.ips = argc > 3 ? std::stoul(argv[3]) : 600;
+	run.seed = argc > 4 ? std::stoul(argv[4]) : 0;
+	if (run.frames < 1 || run.ips == 0) {
+		std::cerr << "Frames and InstructionsPerSecond must be at least 1\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	std::printf("%s dispatch%s, %s, %ld frames at %u instructions/s, seed %u\n", ENGINE_NAME, CHIP8_JIT ? " with the JIT" : "",
+		run.rom, run.frames, run.ips, run.seed);
+
+	bool ok = CheckEngine<Interpreter>("interpreter", run);
+	ok = CheckEngine<Threaded>("threaded", run) && ok;
+#if CHIP8_JIT
+	ok = CheckEngine<Jit>("jit", run) && ok;
+#endif
+	ok = CheckLockstep(run) && ok;
+	ok = CheckState(run) && ok;
+	ok = CheckDamagedState(run) && ok;
+	ok = CheckRewind(run) && ok;
+	ok = CheckMovie(run) && ok;
+
+	// what the reference ended on, for comparing builds with other dispatch engines
+	Reference reference(run, run.seed);
+	Chip8 const& end = reference.At(run.frames);
+	std::printf("end cycles %llu hash %016llx\n", static_cast<unsigned long long>(end.Cycles()),
+		static_cast<unsigned long long>(videoKernels->hash(end.video)));
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}